@@ -0,0 +1,193 @@
+/** \file affinity.c
+    \author Giorgio Vinciguerra
+    \date Giugno 2015
+    \copyright Copyright (c) 2015 Giorgio Vinciguerra. All rights reserved.
+    \note  Si dichiara che il contenuto di questo file è in ogni sua parte opera
+           originale dell' autore.
+    \brief File contenente l'implementazione delle funzioni che assegnano i
+           thread della simulazione ai processori e la memoria del pianeta ai
+           nodi NUMA dei worker.
+*/
+/*
+ INFO SULLA MEMORIA NUMA
+ Linux assegna una pagina di memoria al nodo del processore che la scrive per
+ primo. Il pianeta viene caricato dal thread principale, quindi tutte le sue
+ pagine finiscono sul nodo di quel thread e i worker degli altri nodi leggono
+ memoria remota a ogni chronon. place_planet ricopia il pianeta in un blocco
+ appena allocato (e non ancora scritto) facendo scrivere a ogni worker, già
+ legato al suo processore, le righe che aggiornerà. La topologia si legge da
+ /sys, senza bisogno di libnuma.
+ */
+
+#define _GNU_SOURCE // Per CPU_SET e pthread_attr_setaffinity_np
+
+#include "affinity.h"
+#include "utils.h"
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+
+static int totalCpus;          // n° di processori utilizzabili
+static int *sortedCpus;        // i processori utilizzabili, ordinati per nodo
+static int *cpuNode;           // cpuNode[i] è il nodo del processore sortedCpus[i]
+static int totalNodes;         // n° di nodi NUMA con almeno un processore utilizzabile
+static int affinityWorkers;    // n° di worker
+static int *workerCpu;         // workerCpu[w] è l'indice in sortedCpus del processore del worker w
+static int serviceCpu;         // l'indice in sortedCpus del processore di dispatcher e collector
+
+#ifdef __linux__
+/* Restituisce il nodo NUMA di un processore, cercando la voce nodeN in
+   /sys/devices/system/cpu/cpuC. Senza NUMA tutti i processori sono sul nodo 0 */
+static int node_of_cpu(int cpu)
+{
+    char path[64];
+    sprintf(path, "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+        return 0;
+
+    int node = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+        if (sscanf(entry->d_name, "node%d", &node) == 1)
+            break;
+    closedir(dir);
+    return node;
+}
+#endif
+
+void setup_affinity(int workers)
+{
+#ifdef __linux__
+    cpu_set_t allowed;
+    if (-1 == sched_getaffinity(0, sizeof(allowed), &allowed) || workers < 1)
+        return;
+
+    totalCpus = CPU_COUNT(&allowed);
+    NOT_NULL_OR_FAIL(malloc(totalCpus * sizeof(int)), sortedCpus, "Errore nella lettura della topologia");
+    NOT_NULL_OR_FAIL(malloc(totalCpus * sizeof(int)), cpuNode, "Errore nella lettura della topologia");
+    NOT_NULL_OR_FAIL(malloc(workers * sizeof(int)), workerCpu, "Errore nella lettura della topologia");
+
+    // Ordina i processori per nodo (e per numero all'interno del nodo)
+    int n = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && n < totalCpus; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed))
+            continue;
+        int node = node_of_cpu(cpu), i = n++;
+        for (; i > 0 && cpuNode[i - 1] > node; i--) {
+            sortedCpus[i] = sortedCpus[i - 1];
+            cpuNode[i] = cpuNode[i - 1];
+        }
+        sortedCpus[i] = cpu;
+        cpuNode[i] = node;
+    }
+    totalNodes = 0;
+    for (int i = 0; i < totalCpus; i++)
+        if (i == 0 || cpuNode[i] != cpuNode[i - 1])
+            totalNodes++;
+
+    // Worker in blocchi contigui, distribuiti su tutti i processori (e quindi su tutti i nodi)
+    affinityWorkers = workers;
+    for (int w = 0; w < workers; w++)
+        workerCpu[w] = (long) w * totalCpus / workers;
+    serviceCpu = workerCpu[workers - 1] < totalCpus - 1 ? totalCpus - 1 : 0;
+#endif
+}
+
+void teardown_affinity()
+{
+    free(sortedCpus);
+    free(cpuNode);
+    free(workerCpu);
+    sortedCpus = cpuNode = workerCpu = NULL;
+}
+
+void affinity_thread_attr(pthread_attr_t *attr, int worker)
+{
+    pthread_attr_init(attr);
+#ifdef __linux__
+    if (sortedCpus == NULL)
+        return;
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(sortedCpus[worker == -1 ? serviceCpu : workerCpu[worker % affinityWorkers]], &cpus);
+    pthread_attr_setaffinity_np(attr, sizeof(cpus), &cpus);
+#endif
+}
+
+/* Argomenti di un thread che copia una fascia di righe del pianeta */
+typedef struct placement {
+    planet_t *dst;
+    planet_t *src;
+    int fromRow;
+    int toRow;
+} placement_t;
+
+static void *copy_rows_loop(void *arg)
+{
+    placement_t *band = arg;
+    copy_planet_rows(band->dst, band->src, band->fromRow, band->toRow);
+    return NULL;
+}
+
+int place_planet(planet_t *p)
+{
+    // Senza topologia i worker non sono legati ai processori: il pianeta resta dov'è
+    if (sortedCpus == NULL || affinityWorkers < 1)
+        return 0;
+
+    planet_t *copy = new_planet_like(p);
+    placement_t *bands = malloc(affinityWorkers * sizeof(placement_t));
+    pthread_t *threads = malloc(affinityWorkers * sizeof(pthread_t));
+    if (copy == NULL || bands == NULL || threads == NULL) {
+        free_planet(copy);
+        free(bands);
+        free(threads);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    int started = 0, retval = 0;
+    for (; started < affinityWorkers; started++) {
+        placement_t band = {copy, p, (long) started * p->nrow / affinityWorkers, (long) (started + 1) * p->nrow / affinityWorkers};
+        pthread_attr_t attr;
+        bands[started] = band;
+        affinity_thread_attr(&attr, started);
+        retval = pthread_create(&threads[started], &attr, copy_rows_loop, &bands[started]);
+        pthread_attr_destroy(&attr);
+        if (retval != 0)
+            break;
+    }
+    for (int w = 0; w < started; w++)
+        pthread_join(threads[w], NULL);
+
+    if (retval == 0)
+        replace_planet(p, copy);
+    else
+        free_planet(copy);
+    free(bands);
+    free(threads);
+    errno = retval;
+    return retval == 0 ? 0 : -1;
+}
+
+void print_topology(FILE *f)
+{
+    if (sortedCpus == NULL) {
+        fprintf(f, "Topologia non disponibile: i thread non vengono legati ai processori\n");
+        return;
+    }
+
+    fprintf(f, "Topologia: %d processori su %d nodi NUMA\n", totalCpus, totalNodes);
+    for (int i = 0; i < totalCpus; i++) {
+        if (i == 0 || cpuNode[i] != cpuNode[i - 1])
+            fprintf(f, "%s  nodo %d: cpu", i == 0 ? "" : "\n", cpuNode[i]);
+        fprintf(f, " %d", sortedCpus[i]);
+    }
+    fprintf(f, "\n  worker -> cpu:");
+    for (int w = 0; w < affinityWorkers; w++)
+        fprintf(f, " %d->%d", w, sortedCpus[workerCpu[w]]);
+    fprintf(f, "\n  dispatcher e collector -> cpu %d\n", sortedCpus[serviceCpu]);
+}
@@ -0,0 +1,57 @@
+/** \file affinity.h
+    \author Giorgio Vinciguerra
+    \date Giugno 2015
+    \copyright Copyright (c) 2015 Giorgio Vinciguerra. All rights reserved.
+    \note  Si dichiara che il contenuto di questo file è in ogni sua parte opera
+           originale dell' autore.
+    \brief File contenente i prototipi delle funzioni che assegnano i thread
+           della simulazione ai processori e la memoria del pianeta ai nodi
+           NUMA dei worker.
+*/
+
+#ifndef __AFFINITY__H
+#define __AFFINITY__H
+
+#include "wator.h"
+#include <stdio.h>
+#include <pthread.h>
+
+/** Legge la topologia della macchina (i processori utilizzabili e il loro
+    nodo NUMA) e assegna un processore a ciascun worker: i processori sono
+    ordinati per nodo e i worker vi sono distribuiti in blocchi contigui,
+    così che worker vicini, che aggiornano righe vicine del pianeta, stiano
+    sullo stesso nodo. Dispatcher e collector ricevono un processore non
+    usato dai worker, se c'è.
+    \param workers il n° di worker
+ */
+void setup_affinity(int workers);
+
+/** Prepara gli attributi per creare un thread legato a un processore.
+    Se setup_affinity non è stata chiamata il thread non viene legato.
+    \param attr gli attributi da inizializzare
+    \param worker il n° del worker, oppure -1 per dispatcher e collector
+ */
+void affinity_thread_attr(pthread_attr_t *attr, int worker);
+
+/** Ricopia le matrici del pianeta in memoria nuova: ogni worker, dal proprio
+    processore, scrive per primo una fascia di righe, così che il sistema
+    operativo ne assegni le pagine al suo nodo NUMA. Il worker w copia la
+    w-esima delle fasce di righe in cui è diviso il pianeta, come le righe
+    che aggiorna con i motori pool e wave; con il farm, dove nessun worker
+    possiede righe, non va chiamata. Se setup_affinity non ha rilevato la
+    topologia il pianeta non viene spostato.
+    \param p il pianeta
+    \return 0 se tutto e' andato bene
+    \return -1 se si e' verificato un errore (setta errno); il pianeta non cambia
+ */
+int place_planet(planet_t *p);
+
+/** Stampa su f la topologia letta e il processore assegnato a ogni thread.
+    \param f il file su cui stampare
+ */
+void print_topology(FILE *f);
+
+/** Libera la memoria allocata da setup_affinity. */
+void teardown_affinity();
+
+#endif
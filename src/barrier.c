@@ -0,0 +1,76 @@
+/** \file barrier.c
+    \author Giorgio Vinciguerra
+    \date Giugno 2015
+    \copyright Copyright (c) 2015 Giorgio Vinciguerra. All rights reserved.
+    \note  Si dichiara che il contenuto di questo file è in ogni sua parte opera
+           originale dell' autore.
+    \brief File contenente l'implementazione di una barriera di
+           sincronizzazione a bassa latenza tra thread.
+*/
+
+#include "barrier.h"
+#include "utils.h"
+#include <limits.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+  #include <sys/syscall.h>
+  #include <linux/futex.h>
+#endif
+
+/* Sospende il thread finché *addr vale val (o fino a un risveglio) */
+static inline void futex_wait(int *addr, int val)
+{
+#ifdef __linux__
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+#else
+    sched_yield();
+#endif
+}
+
+/* Risveglia tutti i thread sospesi su addr */
+static inline void futex_wake_all(int *addr)
+{
+#ifdef __linux__
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+void barrier_init(barrier_t *b, unsigned int total)
+{
+    memset(b, 0, sizeof(barrier_t));
+    b->total = total;
+    b->spin = total <= sysconf(_SC_NPROCESSORS_ONLN) ? BARRIER_SPIN : 0;
+}
+
+bool barrier_wait(barrier_t *b, barrier_completion_t completion, void *arg)
+{
+    // La generazione va letta prima di dichiararsi arrivati: dopo potrebbe essere già cambiata
+    int gen = __atomic_load_n(&b->generation, __ATOMIC_ACQUIRE);
+
+    if (__atomic_add_fetch(&b->arrived, 1, __ATOMIC_ACQ_REL) == b->total) {
+        if (completion != NULL)
+            completion(arg);
+        __atomic_store_n(&b->arrived, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&b->generation, gen + 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&b->sleepers, __ATOMIC_SEQ_CST) > 0)
+            futex_wake_all(&b->generation);
+        return true;
+    }
+
+    for (int i = 0; i < b->spin; i++) {
+        if (__atomic_load_n(&b->generation, __ATOMIC_ACQUIRE) != gen)
+            return false;
+        CPU_RELAX();
+    }
+
+    /* sleepers è incrementato prima di ricontrollare generation, e l'ultimo
+       thread cambia generation prima di leggere sleepers: almeno uno dei due
+       vede la scrittura dell'altro, quindi nessun risveglio va perso */
+    __atomic_add_fetch(&b->sleepers, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&b->generation, __ATOMIC_SEQ_CST) == gen)
+        futex_wait(&b->generation, gen);
+    __atomic_sub_fetch(&b->sleepers, 1, __ATOMIC_SEQ_CST);
+    return false;
+}
@@ -0,0 +1,61 @@
+/** \file barrier.h
+    \author Giorgio Vinciguerra
+    \date Giugno 2015
+    \copyright Copyright (c) 2015 Giorgio Vinciguerra. All rights reserved.
+    \note  Si dichiara che il contenuto di questo file è in ogni sua parte opera
+           originale dell' autore.
+    \brief File contenente i prototipi di funzioni per una barriera di
+           sincronizzazione a bassa latenza tra thread.
+*/
+
+#ifndef __BARRIER__H
+#define __BARRIER__H
+
+#include <stdbool.h>
+
+/** Dimensione di una linea di cache, usata per separare i campi della
+    barriera scritti da thread diversi */
+#define BARRIER_CACHE_LINE 64
+
+/** Numero di tentativi che un thread esegue in attesa attiva sulla barriera
+    prima di sospendersi. Se i thread sono più dei processori l'attesa attiva
+    toglierebbe solo tempo a quelli che devono ancora arrivare, e viene
+    evitata. */
+#define BARRIER_SPIN 4096
+
+/** Tipo di una barriera riutilizzabile. I thread che arrivano per primi
+    attendono in modo attivo per al più BARRIER_SPIN tentativi, poi si sospendono
+    (con una futex su Linux) finché l'ultimo thread non cambia generation.
+ */
+typedef struct barrier {
+    unsigned int total;     // n° di thread che si sincronizzano sulla barriera
+    int spin;               // n° di tentativi in attesa attiva prima di sospendersi
+    char padding1[BARRIER_CACHE_LINE];
+    unsigned int arrived;   // n° di thread arrivati nella generazione corrente
+    char padding2[BARRIER_CACHE_LINE];
+    int generation;         // incrementata ogni volta che la barriera si apre
+    int sleepers;           // n° di thread sospesi in attesa
+    char padding3[BARRIER_CACHE_LINE];
+} barrier_t;
+
+/** Funzione eseguita dall'ultimo thread arrivato su una barriera, prima che
+    gli altri vengano rilasciati */
+typedef void (*barrier_completion_t)(void *arg);
+
+/** Inizializza una barriera
+    \param b la barriera
+    \param total il n° di thread che dovranno attendere sulla barriera
+ */
+void barrier_init(barrier_t *b, unsigned int total);
+
+/** Attende che tutti i thread arrivino sulla barriera. L'ultimo thread
+    arrivato esegue completion (se non nullo) mentre gli altri sono ancora
+    fermi, poi li rilascia.
+    \param b la barriera
+    \param completion la funzione da eseguire prima del rilascio, o NULL
+    \param arg argomento passato a completion
+    \return true per il thread che ha eseguito completion, false per gli altri
+ */
+bool barrier_wait(barrier_t *b, barrier_completion_t completion, void *arg);
+
+#endif
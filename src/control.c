@@ -0,0 +1,225 @@
+/** \file control.c
+    \author Giorgio Vinciguerra
+    \date Giugno 2015
+    \copyright Copyright (c) 2015 Giorgio Vinciguerra. All rights reserved.
+    \note  Si dichiara che il contenuto di questo file è in ogni sua parte opera
+           originale dell' autore.
+    \brief File contenente l'implementazione del socket di controllo della
+           simulazione.
+*/
+
+#define _GNU_SOURCE // pipe2
+#include "control.h"
+#include "farm.h"
+#include "phases.h"
+#include "utils.h"
+#include <poll.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+
+/** Dimensione massima della risposta a un comando */
+#define CONTROL_REPLY_LENGTH 4096
+
+static int controlSocket = -1;
+static pthread_t controlThread;
+static volatile bool controlStopping = false;
+static int wakeFds[2] = {-1, -1};      // la pipe con cui stop_control risveglia il thread di controllo
+
+/* Mutex e CV su cui attende il thread che ha concluso un chronon mentre la
+   simulazione è in pausa */
+static pthread_mutex_t controlMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t controlCond = PTHREAD_COND_INITIALIZER;
+static volatile bool paused = false;
+static long stepsLeft = 0;             // chronon da eseguire prima di tornare in pausa (0 nessun limite)
+static volatile bool pauseRequested;   // true se paused o stepsLeft > 0: evita il mutex a ogni chronon
+
+static long startChronon;              // il chronon all'avvio del controllo
+static long lastChronon;               // il chronon all'ultima lettura delle metriche
+static unsigned long long lastTime;    // l'istante dell'ultima lettura delle metriche
+
+void control_chronon_done()
+{
+    if (!pauseRequested)
+        return;
+
+    pthread_mutex_lock(&controlMutex);
+    if (stepsLeft > 0 && --stepsLeft == 0)
+        paused = true;
+    while (paused && !mustTerminateFlag && !mustStopEngine)
+        pthread_cond_wait(&controlCond, &controlMutex);
+    pauseRequested = paused || stepsLeft > 0;
+    pthread_mutex_unlock(&controlMutex);
+}
+
+void control_wake()
+{
+    pthread_mutex_lock(&controlMutex);
+    pthread_cond_broadcast(&controlCond);
+    pthread_mutex_unlock(&controlMutex);
+}
+
+bool control_pause_requested()
+{
+    return pauseRequested;
+}
+
+/* Cambia lo stato di pausa: steps > 0 esegue steps chronon e poi sospende */
+static void set_paused(bool pause, long steps)
+{
+    pthread_mutex_lock(&controlMutex);
+    paused = pause;
+    stepsLeft = steps;
+    pauseRequested = paused || stepsLeft > 0;
+    pthread_cond_broadcast(&controlCond);
+    pthread_mutex_unlock(&controlMutex);
+}
+
+/* Scrive in reply le metriche della simulazione e restituisce la lunghezza del testo */
+static int write_metrics(char *reply, int size)
+{
+    long chronon = wator->chronon;
+    unsigned long long now = phase_now();
+    double rate = now > lastTime ? (chronon - lastChronon) * 1e9 / (now - lastTime) : 0;
+    lastChronon = chronon;
+    lastTime = now;
+
+    // Il thread principale potrebbe riallocare la coda e i contatori dei tempi
+    pthread_mutex_lock(&engineMutex);
+    int n = snprintf(reply, size,
+                     "wator_chronon %ld\n"
+                     "wator_fish %d\n"
+                     "wator_sharks %d\n"
+                     "wator_chronons_per_second %.3f\n"
+                     "wator_paused %d\n"
+                     "wator_workers %d\n"
+                     "wator_queue_depth %lu\n",
+                     chronon, wator->nf, wator->ns, rate, paused ? 1 : 0, totalWorkers,
+                     tasksQueue ? queue_length(tasksQueue) : 0);
+
+    // Per ogni fase il tempo totale e la latenza media per chronon
+    for (int ph = 0; ph < PHASE_COUNT && n < size; ph++) {
+        char name[16];
+        unsigned long long total = phase_total(ph);
+        phase_name(ph, name);
+        n += snprintf(reply + n, size - n,
+                      "wator_phase_seconds_total{phase=\"%s\"} %.6f\n"
+                      "wator_phase_us_per_chronon{phase=\"%s\"} %.3f\n",
+                      name, total / 1e9, name, chronon > startChronon ? total / 1e3 / (chronon - startChronon) : 0);
+    }
+    pthread_mutex_unlock(&engineMutex);
+    return n < size ? n : size - 1;
+}
+
+/* Legge un comando dalla connessione fd, lo esegue e invia la risposta */
+static void serve_command(int fd)
+{
+    char command[CONTROL_COMMAND_LENGTH], reply[CONTROL_REPLY_LENGTH];
+    long steps;
+    int workers;
+    int length = 0;
+
+    // Legge fino al primo a capo, per al più un secondo
+    struct timeval timeout = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    while (length < CONTROL_COMMAND_LENGTH - 1) {
+        ssize_t r = recv(fd, command + length, CONTROL_COMMAND_LENGTH - 1 - length, 0);
+        if (r <= 0)
+            break;
+        length += r;
+        if (memchr(command, '\n', length) != NULL)
+            break;
+    }
+    command[length] = '\0';
+    command[strcspn(command, "\r\n")] = '\0';
+
+    if (command[0] == '\0' || strcmp(command, "metrics") == 0)
+        length = write_metrics(reply, sizeof(reply));
+    else if (strcmp(command, "pause") == 0) {
+        set_paused(true, 0);
+        length = sprintf(reply, "ok\n");
+    }
+    else if (strcmp(command, "resume") == 0) {
+        set_paused(false, 0);
+        length = sprintf(reply, "ok\n");
+    }
+    else if (sscanf(command, "step %ld", &steps) == 1 && steps > 0) {
+        set_paused(false, steps);
+        length = sprintf(reply, "ok\n");
+    }
+    else if (strcmp(command, "checkpoint") == 0) {
+        kill(getpid(), SIGUSR1); // Il checkpoint è eseguito dal thread principale
+        length = sprintf(reply, "ok\n");
+    }
+    else if (sscanf(command, "workers %d", &workers) == 1 && workers > 0) {
+        requestedWorkers = workers;
+        kill(getpid(), SIGTTIN); // Il motore è riavviato dal thread principale
+        length = sprintf(reply, "ok\n");
+    }
+    else
+        length = snprintf(reply, sizeof(reply), "errore: comando '%s' sconosciuto\n", command);
+
+    send(fd, reply, length, MSG_NOSIGNAL);
+}
+
+/* Il ciclo eseguito dal thread di controllo */
+static void *control_loop(void *arg)
+{
+    struct pollfd pfd[2] = {{.fd = controlSocket, .events = POLLIN}, {.fd = wakeFds[0], .events = POLLIN}};
+    while (!controlStopping) {
+        if (poll(pfd, 2, -1) <= 0 || !(pfd[0].revents & POLLIN))
+            continue;
+        int fd = accept(controlSocket, NULL, NULL);
+        if (fd == -1)
+            continue;
+        serve_command(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+void start_control()
+{
+    struct sockaddr_un sockaddr = {.sun_family = AF_UNIX};
+    strncpy(sockaddr.sun_path, CONTROL_PATH, sizeof(sockaddr.sun_path) - 1);
+    unlink(CONTROL_PATH);
+
+    startChronon = lastChronon = wator->chronon;
+    lastTime = phase_now();
+    SC_OR_PERROR(socket(AF_UNIX, SOCK_STREAM, 0), controlSocket, "Impossibile creare il socket di controllo");
+    if (controlSocket == -1)
+        return;
+    if (-1 == bind(controlSocket, (struct sockaddr *) &sockaddr, sizeof(sockaddr))
+        || -1 == listen(controlSocket, SOMAXCONN)
+        || -1 == pipe2(wakeFds, O_CLOEXEC)
+        || 0 != pthread_create(&controlThread, NULL, control_loop, NULL)) {
+        perror("Impossibile avviare il socket di controllo");
+        close(controlSocket);
+        controlSocket = -1;
+        if (wakeFds[0] != -1) {
+            close(wakeFds[0]);
+            close(wakeFds[1]);
+        }
+    }
+}
+
+void stop_control()
+{
+    set_paused(false, 0); // Risveglia la simulazione, se è in pausa
+    if (controlSocket == -1)
+        return;
+    controlStopping = true;
+    if (-1 == write(wakeFds[1], "", 1))
+        perror("Impossibile risvegliare il thread di controllo");
+    pthread_join(controlThread, NULL);
+    close(wakeFds[0]);
+    close(wakeFds[1]);
+    close(controlSocket);
+    unlink(CONTROL_PATH);
+}
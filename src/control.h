@@ -0,0 +1,60 @@
+/** \file control.h
+    \author Giorgio Vinciguerra
+    \date Giugno 2015
+    \copyright Copyright (c) 2015 Giorgio Vinciguerra. All rights reserved.
+    \note  Si dichiara che il contenuto di questo file è in ogni sua parte opera
+           originale dell' autore.
+    \brief File contenente i prototipi delle funzioni del socket di controllo
+           della simulazione.
+
+    Un thread di controllo accetta connessioni sul socket CONTROL_PATH. Un
+    client invia un comando su una riga, riceve la risposta e la connessione
+    viene chiusa. I comandi sono:
+    - metrics (o una riga vuota): le metriche della simulazione, una per riga
+      nel formato testuale di Prometheus ("nome{etichette} valore");
+    - pause: sospende la simulazione alla fine del chronon corrente;
+    - resume: riprende la simulazione;
+    - step N: esegue N chronon e sospende di nuovo la simulazione;
+    - checkpoint: salva subito lo stato del pianeta (come SIGUSR1);
+    - workers N: alla fine del chronon corrente riavvia il motore con N
+      worker (come SIGTTIN, vedi requestedWorkers). Se la simulazione è in
+      pausa viene eseguito un chronon prima di sospenderla di nuovo.
+    Per esempio: echo metrics | nc -U /tmp/wator_control.sck
+*/
+
+#ifndef __CONTROL__H
+#define __CONTROL__H
+
+#include <stdbool.h>
+
+/** Percorso del socket di controllo */
+#define CONTROL_PATH "/tmp/wator_control.sck"
+
+/** Lunghezza massima di un comando */
+#define CONTROL_COMMAND_LENGTH 64
+
+/** Crea il socket di controllo e avvia il thread che lo serve. Va chiamata
+    dopo setup_farm, e non in modalità batch. Se il socket non può essere creato la simulazione
+    prosegue senza controllo. */
+void start_control();
+
+/** Risveglia la simulazione, se sospesa, termina il thread di controllo e
+    rimuove il socket. Va chiamata dopo aver impostato mustTerminateFlag e
+    prima di attendere la terminazione dei worker. */
+void stop_control();
+
+/** Restituisce true se la simulazione è in pausa o sta eseguendo i chronon di
+    un comando step. */
+bool control_pause_requested();
+
+/** Sospende il thread chiamante finché la simulazione è in pausa (vedi i
+    comandi pause e step) e il motore non deve fermarsi. È chiamata dai
+    motori dopo complete_chronon, quando nessun worker è attivo: alla fine di
+    ogni chronon, o di ogni passata per il motore a fronte d'onda. */
+void control_chronon_done();
+
+/** Risveglia il thread sospeso da control_chronon_done, perché ricontrolli
+    mustStopEngine e mustTerminateFlag. La pausa resta in vigore. */
+void control_wake();
+
+#endif
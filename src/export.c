@@ -0,0 +1,268 @@
+/** \file export.c
+    \author Giorgio Vinciguerra
+    \date Giugno 2015
+    \copyright Copyright (c) 2015 Giorgio Vinciguerra. All rights reserved.
+    \note  Si dichiara che il contenuto di questo file è in ogni sua parte opera
+           originale dell' autore.
+    \brief File contenente l'implementazione dell'esportazione dei fotogrammi
+           del pianeta verso i visualizer.
+*/
+
+#define _GNU_SOURCE // pipe2, accept4
+#include "export.h"
+#include "farm.h"
+#include "frame.h"
+#include "phases.h"
+#include "utils.h"
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+/* Un visualizer connesso */
+typedef struct subscriber {
+    int fd;                        // la connessione, non bloccante
+    frame_encoder_t encoder;       // la codifica dei fotogrammi inviati a questo visualizer
+    frame_header_t header;         // il fotogramma in invio, se busy
+    const unsigned char *payload;
+    size_t sent;                   // i byte del fotogramma in invio già scritti sul socket
+    bool busy;
+    unsigned long long last;       // il n° dell'ultimo fotogramma codificato per questo visualizer
+} subscriber_t;
+
+static pthread_t exportThread;
+static volatile bool exportStopping = false;
+static int wakeFds[2] = {-1, -1};  // la pipe con cui export_frame e stop_export risvegliano l'esportatore
+
+/* I tre buffer dei fotogrammi: filling è usato solo da export_frame, latest
+   solo dall'esportatore; pending (con intestazione e numero) passa dall'uno
+   all'altro sotto exportMutex */
+static unsigned char *filling, *pending, *latest;
+static frame_header_t pendingHeader, latestHeader;
+static unsigned long long pendingNumber = 0, latestNumber = 0; // i fotogrammi sono numerati da 1
+static bool hasPending = false;
+static pthread_mutex_t exportMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static subscriber_t *subscribers = NULL;
+static int subscriberCount = 0, subscriberCapacity = 0;
+static unsigned long long skipped = 0; // fotogrammi non inviati ai visualizer perché più lenti della simulazione
+
+void export_frame(planet_t *p)
+{
+    frame_header_t h = {.chronon = wator->chronon, .nf = wator->nf, .ns = wator->ns, .nrow = p->nrow, .ncol = p->ncol};
+    if (frameRing != NULL) {
+        frame_ring_publish(frameRing, p, &h);
+        return;
+    }
+
+    frame_pack(p, filling);
+    pthread_mutex_lock(&exportMutex);
+    unsigned char *swap = pending;
+    pending = filling;
+    filling = swap;
+    pendingHeader = h;
+    pendingNumber++;
+    bool wake = !hasPending;
+    hasPending = true;
+    pthread_mutex_unlock(&exportMutex);
+
+    // Risveglia l'esportatore solo se non ha già un fotogramma da prendere
+    if (wake && -1 == write(wakeFds[1], "", 1) && errno != EAGAIN)
+        perror("Impossibile risvegliare l'esportatore");
+}
+
+/* Chiude la connessione con il visualizer i, rimpiazzandolo con l'ultimo */
+static void remove_subscriber(int i)
+{
+    close(subscribers[i].fd);
+    frame_encoder_free(&subscribers[i].encoder);
+    subscribers[i] = subscribers[--subscriberCount];
+}
+
+/* Accetta tutti i visualizer in attesa di connessione. Con l'anello
+   consegna loro il descrittore, altrimenti il loro primo fotogramma sarà
+   l'ultimo prodotto */
+static void accept_subscribers()
+{
+    int fd;
+    while (-1 != (fd = accept4(visualizerSocket, NULL, NULL, SOCK_CLOEXEC))) {
+        // Nel socket vuoto l'intestazione entra per intero: frame_send_ring non si blocca
+        if (frameRing != NULL && -1 == frame_send_ring(fd, wator->plan->nrow, wator->plan->ncol, frameRingFd)) {
+            perror("Errore nella comunicazione con visualizer");
+            close(fd);
+            continue;
+        }
+        if (-1 == fcntl(fd, F_SETFL, O_NONBLOCK)) {
+            perror("Errore nella configurazione del socket");
+            close(fd);
+            continue;
+        }
+        if (subscriberCount == subscriberCapacity) {
+            int capacity = subscriberCapacity == 0 ? 4 : 2 * subscriberCapacity;
+            subscriber_t *grown = realloc(subscribers, capacity * sizeof(subscriber_t));
+            if (grown == NULL) {
+                perror("Impossibile accettare un altro visualizer");
+                close(fd);
+                continue;
+            }
+            subscribers = grown;
+            subscriberCapacity = capacity;
+        }
+        subscribers[subscriberCount++] = (subscriber_t) {.fd = fd, .last = latestNumber > 0 ? latestNumber - 1 : 0};
+        DEBUG_PRINTF("Visualizer connesso (%d in totale)\n", subscriberCount);
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED)
+        perror("Errore in accept");
+}
+
+/* Prosegue l'invio al visualizer s e, se lo ha concluso, gli invia l'ultimo
+   fotogramma (codificato rispetto all'ultimo che ha ricevuto). Restituisce
+   -1 se la connessione va chiusa */
+static int feed_subscriber(subscriber_t *s)
+{
+    while (true) {
+        if (!s->busy) {
+            if (s->last == latestNumber)
+                return 0;
+            // I fotogrammi prodotti mentre s riceveva i precedenti sono persi per s, ma non per gli altri
+            skipped += latestNumber - s->last - 1;
+            s->last = latestNumber;
+            s->header = latestHeader;
+            if (-1 == frame_encode(&s->encoder, latest, latestHeader.nrow, latestHeader.ncol, &s->header, &s->payload)) {
+                perror("Impossibile codificare il fotogramma del pianeta");
+                return -1;
+            }
+            s->sent = 0;
+            s->busy = true;
+        }
+        if (-1 == frame_send(s->fd, &s->header, s->payload, &s->sent))
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        s->busy = false;
+        DEBUG_PRINTF("Invio matrice (chronon=%lu) completato\n", (unsigned long) s->header.chronon);
+    }
+}
+
+/* Restituisce true se tutti i visualizer hanno ricevuto l'ultimo fotogramma */
+static bool subscribers_idle()
+{
+    for (int i = 0; i < subscriberCount; i++)
+        if (subscribers[i].busy || subscribers[i].last != latestNumber)
+            return false;
+    return true;
+}
+
+/* Il ciclo eseguito dal thread esportatore. Attende in poll nuovi
+   fotogrammi, nuovi visualizer e socket di nuovo scrivibili, così che un
+   visualizer lento non rallenti gli altri. Alla terminazione prova per al
+   più EXPORT_FLUSH_MS millisecondi a inviare a tutti l'ultimo fotogramma */
+static void *export_loop(void *arg)
+{
+    struct pollfd *fds = NULL;
+    int fdsCapacity = 0;
+    unsigned long long deadline = 0;
+
+    while (true) {
+        int timeout = -1;
+        if (exportStopping) {
+            unsigned long long now = phase_now();
+            if (deadline == 0)
+                deadline = now + EXPORT_FLUSH_MS * 1000000ULL;
+            if (subscribers_idle() || now >= deadline)
+                break;
+            timeout = (deadline - now) / 1000000ULL + 1;
+        }
+
+        // Il risveglio, le nuove connessioni e i visualizer (scrivibili, o chiusi se non c'è nulla da inviare)
+        if (fdsCapacity < subscriberCount + 2) {
+            fdsCapacity = subscriberCapacity + 2;
+            NOT_NULL_OR_FAIL(realloc(fds, fdsCapacity * sizeof(struct pollfd)), fds,
+                             "Impossibile allocare i descrittori dei visualizer");
+        }
+        fds[0] = (struct pollfd) {.fd = wakeFds[0], .events = POLLIN};
+        fds[1] = (struct pollfd) {.fd = exportStopping ? -1 : visualizerSocket, .events = POLLIN};
+        for (int i = 0; i < subscriberCount; i++)
+            fds[i + 2] = (struct pollfd) {.fd = subscribers[i].fd, .events = subscribers[i].busy ? POLLOUT : POLLIN};
+        if (-1 == poll(fds, subscriberCount + 2, timeout)) {
+            if (errno != EINTR)
+                perror("Errore in poll");
+            continue;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            char drain[64];
+            while (read(wakeFds[0], drain, sizeof(drain)) > 0);
+        }
+        pthread_mutex_lock(&exportMutex);
+        if (hasPending) {
+            unsigned char *swap = latest;
+            latest = pending;
+            pending = swap;
+            latestHeader = pendingHeader;
+            latestNumber = pendingNumber;
+            hasPending = false;
+        }
+        pthread_mutex_unlock(&exportMutex);
+
+        // Un visualizer non invia dati: se il socket è leggibile è stato chiuso
+        int polled = subscriberCount;
+        for (int i = polled - 1; i >= 0; i--) {
+            bool closed = (fds[i + 2].revents & (POLLERR | POLLHUP | POLLNVAL)) ||
+                          (!subscribers[i].busy && (fds[i + 2].revents & POLLIN));
+            if (closed || (frameRing == NULL && -1 == feed_subscriber(&subscribers[i]))) {
+                if (!closed)
+                    perror("Errore nella comunicazione con visualizer");
+                remove_subscriber(i);
+            }
+        }
+        if (fds[1].revents & POLLIN) {
+            accept_subscribers();
+            for (int i = polled; i < subscriberCount; i++)
+                if (frameRing == NULL && -1 == feed_subscriber(&subscribers[i]))
+                    remove_subscriber(i--);
+        }
+    }
+
+    free(fds);
+    return NULL;
+}
+
+void start_export()
+{
+    int retval;
+    size_t length = frame_packed_length(wator->plan->nrow, wator->plan->ncol);
+    if (frameRing == NULL) {
+        filling = malloc(length);
+        pending = malloc(length);
+        latest = malloc(length);
+        if (filling == NULL || pending == NULL || latest == NULL)
+            print_fatal_error("Impossibile allocare i buffer dei fotogrammi");
+    }
+    SC_OR_FAIL(pipe2(wakeFds, O_NONBLOCK | O_CLOEXEC), retval, "Impossibile creare la pipe dell'esportatore");
+    SC_OR_FAIL(fcntl(visualizerSocket, F_SETFL, O_NONBLOCK), retval, "Errore nella configurazione del socket");
+    SC_OR_FAIL(pthread_create(&exportThread, NULL, export_loop, NULL), retval, "Impossibile creare il thread esportatore");
+}
+
+void stop_export()
+{
+    exportStopping = true;
+    if (-1 == write(wakeFds[1], "", 1) && errno != EAGAIN)
+        perror("Impossibile risvegliare l'esportatore");
+    pthread_join(exportThread, NULL);
+
+    // I visualizer ricevono la fine della connessione
+    while (subscriberCount > 0)
+        remove_subscriber(subscriberCount - 1);
+    free(subscribers);
+    close(wakeFds[0]);
+    close(wakeFds[1]);
+
+    if (skipped > 0)
+        fprintf(stderr, "Fotogrammi non inviati ai visualizer più lenti della simulazione: %llu\n", skipped);
+    free(filling);
+    free(pending);
+    free(latest);
+}
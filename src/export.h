@@ -0,0 +1,56 @@
+/** \file export.h
+    \author Giorgio Vinciguerra
+    \date Giugno 2015
+    \copyright Copyright (c) 2015 Giorgio Vinciguerra. All rights reserved.
+    \note  Si dichiara che il contenuto di questo file è in ogni sua parte opera
+           originale dell' autore.
+    \brief File contenente i prototipi delle funzioni che esportano i
+           fotogrammi del pianeta verso i visualizer.
+
+    Un thread esportatore accetta le connessioni dei visualizer, quanti se ne
+    vuole, e invia loro i fotogrammi, così che la rete non rallenti la
+    simulazione. Alla fine di un chronon da visualizzare complete_chronon si
+    limita a impacchettare il pianeta in un buffer libero (export_frame) e
+    passa subito al chronon successivo. I buffer sono tre: uno in scrittura da
+    export_frame, uno con l'ultimo fotogramma preso dall'esportatore e uno con
+    il fotogramma in attesa di essere preso, sostituito se ne arriva uno
+    nuovo prima.
+
+    Le connessioni sono non bloccanti e l'esportatore le serve tutte con
+    poll. Ogni visualizer riceve un fotogramma alla volta: concluso l'invio
+    del precedente riceve l'ultimo prodotto, codificato rispetto all'ultimo
+    che ha ricevuto, e quelli prodotti nel frattempo sono scartati solo per
+    lui. Così un visualizer lento riceve meno fotogrammi, ma sempre i più
+    recenti, senza rallentare la simulazione né gli altri visualizer.
+
+    Con l'anello in memoria condivisa (vedi frameRing) export_frame pubblica
+    direttamente il fotogramma nell'anello, e l'esportatore si limita a
+    consegnare l'anello ai visualizer che si connettono.
+*/
+
+#ifndef __EXPORT__H
+#define __EXPORT__H
+
+#include "wator.h"
+
+/** Tempo massimo, in millisecondi, concesso alla terminazione per l'invio
+    dell'ultimo fotogramma */
+#define EXPORT_FLUSH_MS 2000
+
+/** Alloca i buffer dei fotogrammi e avvia il thread esportatore, che
+    eredita la mask dei segnali del thread chiamante. Va chiamata dopo aver
+    creato visualizerSocket (ed eventualmente frameRing). */
+void start_export();
+
+/** Termina il thread esportatore, dopo l'invio dell'ultimo fotogramma a
+    tutti i visualizer (o interrompendolo, se dura più di EXPORT_FLUSH_MS),
+    chiude le connessioni e libera i buffer. Va
+    chiamata quando nessun thread chiama più export_frame. */
+void stop_export();
+
+/** Esporta il pianeta p al chronon corrente senza attendere i visualizer.
+    \param p il pianeta
+ */
+void export_frame(planet_t *p);
+
+#endif
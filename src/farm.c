@@ -9,20 +9,27 @@
 
 #include "farm.h"
 #include "utils.h"
-#include "visualizer.h"
+#include "phases.h"
+#include "trace.h"
+#include "control.h"
+#include "export.h"
 #include <errno.h>
 #include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <signal.h>
 #include <unistd.h>
 #include <sys/socket.h>
 
-volatile farm_status_t farmStatus = DISPATCHING_BATCH_1;
-static volatile int completedTasks; // n° di task completati
-static int tasksInBatch1;           // n° di task nel gruppo 1 (rettang orizzontali)
-static int tasksInBatch2;           // n° di task nel gruppo 2 (rettang orizz alti 2 celle)
-static int tasksInBatch3;           // n° di task nel gruppo 3 (un rettang vertic largo 2 celle)
-static bool volatile **cellsToSkip; // Celle a cui sono già state applicate le regole nel chron corrente
+volatile farm_status_t farmStatus = DISPATCHING_BATCH;
+static volatile int completedTasks; // n° di task completati nel chronon corrente
+static volatile int currentBatch;   // il batch in esecuzione (o da inserire in coda)
+static int *batchEnd;               // batchEnd[b] è il n° di task dei batch da 0 a b
+static unsigned long long batchStart; // l'istante in cui il batch corrente è stato inserito in coda
+static int partitionRows, partitionCols; // la dimensione dei riquadri di planetPartition
+partition_t *planetPartition;
+worker_delta_t *workerDeltas;
 
 /* Mutex sulla variabile farmStatus della struttura a farm. Permette la
    mutua esclusione tra dispatcher-workers e collector */
@@ -34,181 +41,172 @@ static pthread_cond_t farmStatusCondDisp = PTHREAD_COND_INITIALIZER;
 /* CV usata per avvisare il collector di un cambio di stato */
 static pthread_cond_t farmStatusCondColl = PTHREAD_COND_INITIALIZER;
 
-void *dispatcher_loop(void *arg)
+void setup_farm()
 {
-    // Calcola una volta per tutte la suddivisione della matrice
-    int nrow = wator->plan->nrow;
-    int ncol = wator->plan->ncol;
-    int planetSlices = totalWorkers + 1; // Prova a suddividere in base al n° worker
-    int stdRectHeight;                   // L'altezza di base di un rettangolo
-    int stdRectWidth = ncol - 2;         // La larghezza di un rettangolo
-
-    do {
-        planetSlices--;
-        stdRectHeight = (nrow - 2.0 * planetSlices) / planetSlices;
-    } while(stdRectHeight < 2);
-    DEBUG_PRINTF("slices=%d, height=%d, width=%d\n", planetSlices, stdRectHeight, stdRectWidth);
-
-    tasksInBatch1 = planetSlices;
-    tasksInBatch2 = planetSlices;
-    tasksInBatch3 = 1;
-    int i = 0;
-    int numberOfTasks = tasksInBatch1 + tasksInBatch2 + tasksInBatch3;
-    bool isLastRectBigger = (nrow - planetSlices) % planetSlices != 0;
-    rect_t *planetRectangles[numberOfTasks];
-
-    // Primo batch
-    for (; i < (isLastRectBigger ? tasksInBatch1 - 1 : tasksInBatch1); ++i) {
-        int fromRow = i * (stdRectHeight + 2);
-        rect_t *horizRect = make_rect(fromRow, 0,  stdRectWidth, stdRectHeight);
-        planetRectangles[i] = horizRect;
-    }
-    if (isLastRectBigger) { // c'è un avanzo di righe da assegnare nell'ultimo task
-        int fromRow = i * (stdRectHeight + 2);
-        int height  = nrow - 2 - fromRow;
-        rect_t *largeHorizRect = make_rect(fromRow, 0, stdRectWidth, height);
-        planetRectangles[i++] = largeHorizRect;
-    }
-    // Secondo batch
-    for (; i < (isLastRectBigger ? tasksInBatch1 - 1 : tasksInBatch1) + tasksInBatch2; ++i) {
-        int fromRow = (i - tasksInBatch1) * (stdRectHeight + 2) + stdRectHeight;
-        rect_t *twoSpacesHorizRect = make_rect(fromRow, 0,  ncol, 2);
-        planetRectangles[i] = twoSpacesHorizRect;
-    }
-    if (isLastRectBigger) {
-        rect_t *largeHorizRect = planetRectangles[tasksInBatch1-1];
-        int fromRow = largeHorizRect->fromRow + largeHorizRect->rows;
-        rect_t *twoSpacesHorizRect = make_rect(fromRow, 0, ncol, 2);
-        planetRectangles[i++] = twoSpacesHorizRect;
+    farmStatus = DISPATCHING_BATCH;
+    completedTasks = 0;
+    currentBatch = 0;
+
+    /* Calcola la suddivisione della matrice. Se il motore viene riavviato con
+       riquadri della stessa dimensione tiene quella già ribilanciata: il
+       pianeta evolve come se il motore non fosse stato riavviato */
+    int nrow = wator->plan->nrow, ncol = wator->plan->ncol;
+    if (tileRows == 0 || tileCols == 0)
+        tileRows = tileCols = partition_tile_side(nrow, ncol, totalWorkers);
+    if (planetPartition == NULL || tileRows != partitionRows || tileCols != partitionCols) {
+        free_partition(planetPartition);
+        NOT_NULL_OR_FAIL(new_partition(nrow, ncol, tileRows, tileCols), planetPartition,
+                         "La creazione di un rettangolo è fallita");
+        partitionRows = tileRows;
+        partitionCols = tileCols;
     }
-    // Terzo e ultimo batch
-    rect_t *twoSpacesVertRect = make_rect(0, ncol - 2,  2, nrow);
-    planetRectangles[i] = twoSpacesVertRect;
-
-    for (int i = 0; i < numberOfTasks; i++)
-        if (planetRectangles[i] == NULL)
-            print_fatal_error("La creazione di un rettangolo è fallita");
-
-    // Alloca la matrice delle celle da saltare
-    cellsToSkip = (bool volatile **) malloc(nrow * sizeof(bool *));
-    if (cellsToSkip == NULL)
-        print_fatal_error("Errore nel setup del dispatcher");
-    bool outOfMemory = false;
-    unsigned int row = 0;     // È qui perché essere visibile al codice di pulizia
-    for (; row < nrow; row++) {
-        cellsToSkip[row] = (bool *) malloc(ncol * sizeof(bool));
-        if (cellsToSkip[row] == NULL) {
-            outOfMemory = true;
-            break;
-        }
-    }
-    if (outOfMemory) { // Una malloc ha fallito, fa pulizia
-        for (unsigned int i = 0; i < row; i++)
-            free((void *) cellsToSkip[i]);
-        free(cellsToSkip);
-        print_fatal_error("Errore nel setup del dispatcher");
+    NOT_NULL_OR_FAIL(malloc(planetPartition->numBatches * sizeof(int)), batchEnd, "Errore nel setup della farm");
+    for (int b = 0, end = 0; b < planetPartition->numBatches; b++)
+        batchEnd[b] = end += planetPartition->batchSize[b];
+
+    // Alloca le variazioni della popolazione dei worker, prima che ricevano dei task
+    if (0 != posix_memalign((void **) &workerDeltas, PLANET_ALIGNMENT, totalWorkers * sizeof(worker_delta_t)))
+        print_fatal_error("Errore nel setup della farm");
+    memset(workerDeltas, 0, totalWorkers * sizeof(worker_delta_t));
+
+    // Un contatore dei tempi per ogni worker, più uno per il dispatcher e uno per il collector
+    setup_phases(totalWorkers + 2);
+}
+
+void teardown_farm(bool keepPartition)
+{
+    if (!keepPartition) {
+        free_partition(planetPartition);
+        planetPartition = NULL;
     }
+    free(batchEnd);
+    free(workerDeltas);
+    teardown_phases();
+}
+
+void create_worker_file(int workerNumber)
+{
+    char filename[18];
+    sprintf(filename, "wator_worker_%d", workerNumber);
+    FILE *fp = fopen(filename, "w");
+    if (!fp)
+        print_fatal_error("Impossibile creare un file wator_worker_wid");
+    fclose(fp);
+}
+
+void *dispatcher_loop(void *arg)
+{
+    phase_thread(totalWorkers);
+    trace_thread(TRACE_DISPATCHER);
 
     /* ======================== DISPATCHER-LOOP ============================= */
     while (true) {
+        unsigned long long start = phase_now();
         pthread_mutex_lock(&farmStatusMutex);
+        phase_add(PHASE_LOCK, start);
 
-        for (int r = 0; r < nrow; r++)
-            memset((void*) cellsToSkip[r], 0, ncol * sizeof(bool));
-
-        while (farmStatus != DISPATCHING_BATCH_1 && farmStatus != TERMINATING)
+        while (farmStatus != DISPATCHING_BATCH && farmStatus != TERMINATING)
             pthread_cond_wait(&farmStatusCondDisp, &farmStatusMutex);
         if (farmStatus == TERMINATING) {
             pthread_mutex_unlock(&farmStatusMutex);
             break;
         }
 
-        /* ================== PRIMO BATCH di task =========================== */
-        int i;
-        for (i = completedTasks = 0; i < tasksInBatch1; ++i)
-            enqueue(tasksQueue, planetRectangles[i]);
-
-        while (farmStatus != DISPATCHING_BATCH_2)
-            pthread_cond_wait(&farmStatusCondDisp, &farmStatusMutex);
+        /* I task di un batch non superano la capacità della coda: enqueue
+           non si blocca mentre il mutex è acquisito */
+        DEBUG_ASSERT(completedTasks == (currentBatch == 0 ? 0 : batchEnd[currentBatch - 1]));
+        batchStart = phase_now();
+        for (int i = 0; i < planetPartition->batchSize[currentBatch]; ++i)
+            enqueue(tasksQueue, planetPartition->batch[currentBatch][i]);
+        trace_event(TRACE_DISPATCH, batchStart, phase_now(), NULL, currentBatch, wator->chronon);
+        farmStatus = RUNNING_BATCH;
 
-        DEBUG_ASSERT(completedTasks == tasksInBatch1);
-
-        /* ================== SECONDO BATCH di task ========================= */
-        for (; i < tasksInBatch1 + tasksInBatch2; ++i)
-            enqueue(tasksQueue, planetRectangles[i]);
+        pthread_mutex_unlock(&farmStatusMutex);
+    }
 
-        while (farmStatus != DISPATCHING_BATCH_3)
-            pthread_cond_wait(&farmStatusCondDisp, &farmStatusMutex);
+    return NULL;
+}
 
-        DEBUG_ASSERT(completedTasks == tasksInBatch1 + tasksInBatch2);
+/* Attende la scadenza del chronon corrente, così che tra la conclusione di
+   due chronon passino almeno chronDelay microsecondi. Le scadenze sono
+   assolute: il tempo speso nel calcolo del chronon è già parte
+   dell'intervallo, e l'attesa non si somma al calcolo */
+static void pace_chronon()
+{
+    static unsigned long long deadline = 0; // l'istante in cui può concludersi il chronon corrente
+    unsigned long long interval = chronDelay * 1000ULL, now = phase_now();
+
+    // Al primo chronon, o se la simulazione è rimasta indietro di più di un intervallo (ad esempio dopo una pausa), non recupera il ritardo
+    if (deadline == 0 || now > deadline + interval)
+        deadline = now;
+    else if (now < deadline) {
+        struct timespec t = {deadline / 1000000000ULL, deadline % 1000000000ULL};
+        while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL));
+    }
+    deadline += interval;
+}
 
-        /* ================= TERZO BATCH di task =========================== */
-        enqueue(tasksQueue, planetRectangles[i]);
+void complete_chronon()
+{
+    planet_t *p = wator->plan;
 
-        pthread_mutex_unlock(&farmStatusMutex);
+    unsigned long long start = phase_now(), chrononStart = start;
+    if (chronDelay > 0) {
+        pace_chronon();
+        start = phase_add(PHASE_DELAY, start);
+    }
+    wator->chronon++;
+
+    // Nessun worker è attivo: somma le variazioni della popolazione del chronon
+    for (int i = 0; i < totalWorkers; i++)
+        apply_delta((wator_t *) wator, &workerDeltas[i].delta);
+    DEBUG_ASSERT(wator->nf == fish_count(p) && wator->ns == shark_count(p));
+
+    // Sposta i confini dei riquadri dove si sono spostati pesci e squali
+    if (rebalanceInterval > 0 && wator->chronon % rebalanceInterval == 0) {
+        if (-1 == rebalance_partition(planetPartition, p))
+            perror("Impossibile ribilanciare la suddivisione del pianeta");
+        start = phase_add(PHASE_REBALANCE, start);
     }
 
-    for (int i = 0; i < numberOfTasks; ++i)
-        free(planetRectangles[i]);
+    // Invio matrice a un processo visualizer, per mezzo del thread esportatore
+    if (visualizerSocket != -1 && wator->chronon % chrInterval == 0) {
+        export_frame(p);
+        phase_add(PHASE_SEND, start);
+    }
 
-    return NULL;
+    if (maxChronons > 0 && wator->chronon >= maxChronons && !mustTerminateFlag) {
+        mustTerminateFlag = true;
+        kill(getpid(), SIGTERM); // Risveglia il thread principale, in attesa di un segnale
+    }
+    trace_event(TRACE_CHRONON, chrononStart, phase_now(), NULL, -1, wator->chronon - 1);
 }
 
-/** Macro per l'esecuzione di una chiamata di sistema o di libreria. Se il
-    risultato (che verrà salvato in var) è -1, stampa str, rilascia la lock e
-    salta alla prossima iterazione della simulazione.
- */
-#define SC_OR_CONTINUE(syscall, var, str) \
-  if ((var = syscall) == -1) { \
-      perror(str); \
-      farmStatus = DISPATCHING_BATCH_1; \
-      pthread_cond_signal(&farmStatusCondDisp); \
-      pthread_mutex_unlock(&farmStatusMutex); \
-      continue; \
-  }
-
 void *collector_loop(void *arg)
 {
-    planet_t *p = wator->plan;
-    unsigned int nrow = p->nrow;
-    unsigned int ncol = p->ncol;
+    phase_thread(totalWorkers + 1);
+    trace_thread(TRACE_COLLECTOR);
 
     while (true) {
+        unsigned long long start = phase_now();
         pthread_mutex_lock(&farmStatusMutex);
+        phase_add(PHASE_LOCK, start);
 
         while (farmStatus != COLLECTING && farmStatus != TERMINATING)
             pthread_cond_wait(&farmStatusCondColl, &farmStatusMutex);
+        pthread_mutex_unlock(&farmStatusMutex);
 
-        usleep(chronDelay);
-        wator->chronon++;
-        DEBUG_ASSERT(completedTasks == tasksInBatch1 + tasksInBatch2 + tasksInBatch3);
-
-        // Invio matrice a un processo visualizer
-        if (wator->chronon % chrInterval == 0) {
-            ssize_t retval;
-            close(visualizerConnectionFd);
-            SC_OR_CONTINUE(accept(visualizerSocket, NULL, NULL), visualizerConnectionFd, "Errore in accept");
-            SC_OR_CONTINUE(send(visualizerConnectionFd, &nrow, MESSAGE_TYPE1_LENGTH, 0), retval, "Errore nella comunicazione con visualizer");
-            SC_OR_CONTINUE(send(visualizerConnectionFd, &ncol, MESSAGE_TYPE1_LENGTH, 0), retval, "Errore nella comunicazione con visualizer");
-
-            char buffer[MESSAGE_TYPE2_LENGTH];
-            int buffIndex = 0;
-            for (int r = 0; r < nrow; r++)
-                for (int c = 0; c < ncol; c++) {
-                    buffer[buffIndex++] = cell_to_char(p->w[r][c]);
-                    if (buffIndex == MESSAGE_TYPE2_LENGTH) { // Buffer full
-                        SC_OR_CONTINUE(send(visualizerConnectionFd, buffer, MESSAGE_TYPE2_LENGTH, 0), retval, "Errore nella comunicazione con visualizer");
-                        buffIndex = 0;
-                    }
-                }
-            if (buffIndex > 0) { // C'è ancora un ultimo messaggio (non pieno) da inviare
-                memset((void*)&buffer[buffIndex+1], 0, MESSAGE_TYPE2_LENGTH - buffIndex - 1);
-                SC_OR_CONTINUE(send(visualizerConnectionFd, buffer, MESSAGE_TYPE2_LENGTH, 0), retval, "Errore nella comunicazione con visualizer");
-            }
-            DEBUG_PRINTF("Invio matrice (chronon=%d) completato\n", wator->chronon);
-        }
+        /* Nello stato COLLECTING nessun altro thread modifica lo stato della
+           farm: il chronon si conclude (attesa di chronDelay compresa) senza
+           tenere il mutex */
+        DEBUG_ASSERT(completedTasks == planetPartition->totalRects);
+        complete_chronon();
+        control_chronon_done(); // Se la simulazione è in pausa attende il comando che la riprende
 
-        if (mustTerminateFlag) {
+        start = phase_now();
+        pthread_mutex_lock(&farmStatusMutex);
+        phase_add(PHASE_LOCK, start);
+        if (mustTerminateFlag || mustStopEngine) {
             destroy_queue(tasksQueue);
             farmStatus = TERMINATING;
             pthread_cond_signal(&farmStatusCondDisp); // Avvisa il dispatcher di non continuare il suo lavoro
@@ -216,7 +214,9 @@ void *collector_loop(void *arg)
             return NULL;
         }
 
-        farmStatus = DISPATCHING_BATCH_1;
+        completedTasks = 0;
+        currentBatch = 0;
+        farmStatus = DISPATCHING_BATCH;
         pthread_cond_signal(&farmStatusCondDisp);
         pthread_mutex_unlock(&farmStatusMutex);
     }
@@ -229,19 +229,22 @@ void *collector_loop(void *arg)
    della lavorazione di un rettangolo. */
 static inline void increment_completedTasks()
 {
+    unsigned long long start = phase_now();
     pthread_mutex_lock(&farmStatusMutex);
+    phase_add(PHASE_LOCK, start);
     completedTasks++;
-    if (completedTasks == tasksInBatch1) {
-        farmStatus = DISPATCHING_BATCH_2;
-        pthread_cond_signal(&farmStatusCondDisp);
-    }
-    if (completedTasks == tasksInBatch1 + tasksInBatch2) {
-        farmStatus = DISPATCHING_BATCH_3;
-        pthread_cond_signal(&farmStatusCondDisp);
-    }
-    if (completedTasks == tasksInBatch1 + tasksInBatch2 + tasksInBatch3) {
-        farmStatus = COLLECTING;
-        pthread_cond_signal(&farmStatusCondColl);
+    if (completedTasks == batchEnd[currentBatch]) {
+        trace_event(TRACE_BATCH, batchStart, phase_add(PHASE_BATCH + currentBatch, batchStart),
+                    NULL, currentBatch, wator->chronon);
+        if (currentBatch == planetPartition->numBatches - 1) {
+            farmStatus = COLLECTING;
+            pthread_cond_signal(&farmStatusCondColl);
+        }
+        else {
+            currentBatch++;
+            farmStatus = DISPATCHING_BATCH;
+            pthread_cond_signal(&farmStatusCondDisp);
+        }
     }
     pthread_mutex_unlock(&farmStatusMutex);
 }
@@ -249,20 +252,20 @@ static inline void increment_completedTasks()
 void *worker_loop(void *arg)
 {
     int workerNumber = *(int *)arg;
-    char filename[18];
-    sprintf(filename, "wator_worker_%d", workerNumber);
-    FILE *fp = fopen(filename, "w");
-    if (!fp)
-        print_fatal_error("Impossibile creare un file wator_worker_wid");
-    fclose(fp);
+    create_worker_file(workerNumber);
     free(arg);
+    phase_thread(workerNumber);
+    trace_thread(workerNumber);
 
     while (true) {
+        unsigned long long start = phase_now();
         rect_t *rect = dequeue(tasksQueue); // Si mette in attesa se la coda è vuota
         if (rect == NULL) // La coda è stata distrutta, cioé il programma sta per terminare
             break;
 
-        update_wator_rect((wator_t*) wator, rect, (bool**) cellsToSkip);
+        start = phase_add(PHASE_DEQUEUE, start);
+        update_wator_rect((wator_t*) wator, rect, &workerDeltas[workerNumber].delta);
+        trace_event(TRACE_TASK, start, phase_add(PHASE_UPDATE, start), rect, currentBatch, wator->chronon);
         increment_completedTasks();
     }
 
@@ -14,9 +14,36 @@
 
 #include "wator.h"
 #include "queue.h"
+#include "partition.h"
+#include "visualizer.h"
 #include <unistd.h>
 #include <stdbool.h>
 
+/** Calcola la suddivisione del pianeta e alloca le variazioni della
+    popolazione dei worker. Va chiamata prima di creare i thread, qualunque
+    sia il motore di esecuzione scelto, e di nuovo dopo teardown_farm se il
+    numero di worker cambia. */
+void setup_farm();
+
+/** Libera la memoria allocata da setup_farm.
+    \param keepPartition true se la suddivisione del pianeta va tenuta per
+           la prossima chiamata a setup_farm (riavvio del motore)
+ */
+void teardown_farm(bool keepPartition);
+
+/** Crea il file wator_worker_wid del worker con numero workerNumber. */
+void create_worker_file(int workerNumber);
+
+/** Conclude un chronon: se serve attende che siano passati chronDelay
+    microsecondi dalla conclusione del precedente, incrementa il chronon, somma le
+    variazioni della popolazione dei worker, ogni rebalanceInterval chronon
+    ribilancia la suddivisione del pianeta e, ogni chrInterval chronon, esporta
+    il pianeta verso il visualizer (vedi export_frame). Raggiunti maxChronon
+    chronon avvia la terminazione gentile. Va chiamata quando nessun worker è
+    attivo; il motore chiama poi control_chronon_done quando il pianeta è
+    all'ultimo chronon concluso. */
+void complete_chronon();
+
 /** Il ciclo eseguito da uno dei thread worker. */
 void *worker_loop(void *arg);
 
@@ -32,26 +59,81 @@ extern volatile wator_t *wator;
 /** Flag che informa i thread dell'esecuzione della "terminazione gentile" */
 extern volatile bool mustTerminateFlag;
 
-/** Il socket del server wator */
+/** Flag che chiede ai thread del motore di terminare alla fine del chronon
+    corrente (della passata, per il motore a fronte d'onda) senza terminare
+    la simulazione, per riavviare il motore con un altro numero di worker */
+extern volatile bool mustStopEngine;
+
+/** Il numero di worker richiesto dal comando workers del socket di
+    controllo, applicato alla ricezione di SIGTTIN. 0 se non è stato
+    richiesto alcun numero */
+extern volatile int requestedWorkers;
+
+/** Mutex acquisito dal thread principale mentre riavvia il motore, e da chi
+    legge le strutture del motore (coda, contatori dei tempi) da un altro
+    thread */
+extern pthread_mutex_t engineMutex;
+
+/** Il socket del server wator. -1 sta ad indicare che la simulazione è
+    senza visualizer (modalità batch) */
 extern volatile int visualizerSocket;
 
-/** Il delay in microsecondi tra un chronon e l'altro */
+/** L'intervallo minimo in microsecondi tra la conclusione di un chronon e
+    quella del successivo: il tempo di calcolo fa parte dell'intervallo, così
+    che la simulazione proceda al più a 1000000/chronDelay chronon al
+    secondo. 0 non limita la velocità */
 extern volatile useconds_t chronDelay;
 
-/** La connessione con un client visualizer. -1 sta ad indicare che nessun visualizer è connesso */
-extern volatile int visualizerConnectionFd;
+/** L'anello in memoria condivisa in cui vengono pubblicati i fotogrammi del
+    pianeta (opzione -m), e il suo descrittore. NULL sta ad indicare che i
+    fotogrammi sono inviati sul socket. In entrambi i casi la simulazione non
+    attende mai i visualizer (vedi export.h) */
+extern frame_ring_t *frameRing;
+extern int frameRingFd;
 
 /** Intervallo in chronon tra le comunicazioni col visualizer */
 extern volatile long chrInterval;
 
+/** N° di chronon dopo il quale la simulazione avvia da sola la terminazione
+    gentile. 0 sta ad indicare che non c'è un limite */
+extern long maxChronons;
+
+/** Intervallo in chronon tra un ribilanciamento della suddivisione del
+    pianeta e l'altro. 0 disattiva il ribilanciamento */
+extern long rebalanceInterval;
+
 /** La coda concorrente dei task */
 extern volatile queue_t *tasksQueue;
 
-/** Il numero totale di worker attivi nella simulazione */
+/** Il numero totale di worker attivi nella simulazione. Cambia solo mentre
+    il motore è fermo (vedi mustStopEngine) */
 extern int totalWorkers;
 
-/** I possibili stati che può assumere la struttura a farm della simulazione */
-typedef enum {DISPATCHING_BATCH_1, DISPATCHING_BATCH_2, DISPATCHING_BATCH_3, COLLECTING, TERMINATING} farm_status_t;
+/** Altezza e larghezza dei riquadri in cui è suddiviso il pianeta. Se valgono
+    0 vengono scelte da setup_farm in base al pianeta e al numero di worker */
+extern int tileRows, tileCols;
+
+/** Le variazioni della popolazione accumulate da un worker nel chronon
+    corrente. Ogni worker scrive solo nella propria, che occupa un'intera linea
+    di cache per non condividerla con quella di un altro worker (false sharing).
+    Vengono sommate a wator->nf e wator->ns una volta per chronon. */
+typedef union {
+    wator_delta_t delta;
+    char padding[PLANET_ALIGNMENT];
+} worker_delta_t;
+
+/** Le variazioni della popolazione, una per worker */
+extern worker_delta_t *workerDeltas;
+
+/** La suddivisione del pianeta in batch di rettangoli */
+extern partition_t *planetPartition;
+
+/** I possibili stati che può assumere la struttura a farm della simulazione:
+    DISPATCHING_BATCH il dispatcher deve inserire in coda il batch corrente
+    RUNNING_BATCH i worker stanno aggiornando i rettangoli del batch corrente
+    COLLECTING tutti i batch sono stati completati, il collector chiude il chronon
+    TERMINATING la simulazione sta terminando */
+typedef enum {DISPATCHING_BATCH, RUNNING_BATCH, COLLECTING, TERMINATING} farm_status_t;
 
 /** Lo stato corrente della simulazione */
 extern volatile farm_status_t farmStatus;
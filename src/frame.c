@@ -0,0 +1,458 @@
+/** \file frame.c
+    \author Giorgio Vinciguerra
+    \date Giugno 2015
+    \copyright Copyright (c) 2015 Giorgio Vinciguerra. All rights reserved.
+    \note  Si dichiara che il contenuto di questo file è in ogni sua parte opera
+           originale dell' autore.
+    \brief File contenente l'implementazione della codifica e della
+           trasmissione dei fotogrammi del pianeta.
+*/
+
+#define _GNU_SOURCE // Per memfd_create
+#include "frame.h"
+#include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+/* Le celle impacchettate della posizione s dell'anello r */
+#define RING_CELLS(r, s) ((unsigned char *) (r) + sizeof(frame_ring_t) + (size_t) (s) * (r)->slotLength)
+
+/* N° di tentativi di lettura di un fotogramma dell'anello sovrascritto mentre veniva letto */
+#define RING_READ_ATTEMPTS 4
+
+size_t frame_packed_length(unsigned int nrow, unsigned int ncol)
+{
+    return ((size_t) nrow * ncol + 3) / 4;
+}
+
+void frame_pack(planet_t *p, unsigned char *out)
+{
+    unsigned char byte = 0;
+    unsigned int shift = 0;
+    for (unsigned int r = 0; r < p->nrow; r++) {
+        const cell_t *rowCells = &p->wcells[CELL_INDEX(p, r, 0)];
+        for (unsigned int c = 0; c < p->ncol; c++) {
+            byte |= rowCells[c] << shift;
+            shift += 2;
+            if (shift == 8) {
+                *out++ = byte;
+                byte = 0;
+                shift = 0;
+            }
+        }
+    }
+    if (shift > 0) // Le celle dell'ultimo byte, incompleto
+        *out = byte;
+}
+
+int frame_unpack(const unsigned char *in, cell_t *cells, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        unsigned int cell = in[i / 4] >> (i % 4 * 2) & 3;
+        if (cell != SHARK && cell != FISH && cell != WATER) {
+            errno = EPROTO;
+            return -1;
+        }
+        cells[i] = cell;
+    }
+    return 0;
+}
+
+int frame_send(int fd, frame_header_t *h, const void *payload, size_t *sent)
+{
+    h->magic = FRAME_MAGIC;
+    h->version = FRAME_VERSION;
+    struct iovec iov[2] = {{h, sizeof(*h)}, {(void *) payload, h->length}};
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = 2};
+
+    // Intestazione e contenuto in un'unica chiamata, ripetuta finché non sono stati inviati tutti i byte
+    size_t skip = *sent;
+    while (msg.msg_iovlen > 0) {
+        while (msg.msg_iovlen > 0 && skip >= msg.msg_iov->iov_len) {
+            skip -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen == 0)
+            break;
+        msg.msg_iov->iov_base = (char *) msg.msg_iov->iov_base + skip;
+        msg.msg_iov->iov_len -= skip;
+
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        *sent += n;
+        skip = n;
+    }
+    return 0;
+}
+
+int frame_send_ring(int fd, unsigned int nrow, unsigned int ncol, int ringFd)
+{
+    frame_header_t h = {.magic = FRAME_MAGIC, .version = FRAME_VERSION, .type = FRAME_RING, .nrow = nrow, .ncol = ncol};
+    struct iovec iov = {&h, sizeof(h)};
+    union { // Allinea il buffer dei dati di controllo
+        struct cmsghdr header;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf, .msg_controllen = sizeof(control.buf)};
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &ringFd, sizeof(int));
+
+    ssize_t sent;
+    while (-1 == (sent = sendmsg(fd, &msg, MSG_NOSIGNAL)))
+        if (errno != EINTR)
+            return -1;
+    // Se l'invio è parziale completa l'intestazione, senza ripetere il descrittore
+    for (size_t done = sent; done < sizeof(h); done += sent)
+        while (-1 == (sent = send(fd, (char *) &h + done, sizeof(h) - done, MSG_NOSIGNAL)))
+            if (errno != EINTR)
+                return -1;
+    return 0;
+}
+
+/* Riceve esattamente length byte in buf. Restituisce -1 con errno a 0 se la
+   connessione viene chiusa prima. Se passedFd non è NULL vi scrive il
+   descrittore eventualmente ricevuto con i dati (altrimenti -1) */
+static int recv_all(int fd, void *buf, size_t length, int *passedFd)
+{
+    union {
+        struct cmsghdr header;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    if (passedFd != NULL)
+        *passedFd = -1;
+
+    while (length > 0) {
+        struct iovec iov = {buf, length};
+        struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf, .msg_controllen = sizeof(control.buf)};
+        ssize_t r = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        struct cmsghdr *cmsg = r > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+        if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            int received;
+            memcpy(&received, CMSG_DATA(cmsg), sizeof(int));
+            if (passedFd != NULL && *passedFd == -1)
+                *passedFd = received;
+            else
+                close(received);
+        }
+        if (r == 0) {
+            errno = 0;
+            return -1;
+        }
+        if (r == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf = (char *) buf + r;
+        length -= r;
+    }
+    return 0;
+}
+
+int frame_recv(int fd, frame_header_t *h, unsigned char **payload, size_t *capacity, int *passedFd)
+{
+    if (-1 == recv_all(fd, h, sizeof(*h), passedFd))
+        return -1;
+    if (h->magic != FRAME_MAGIC || h->version != FRAME_VERSION) {
+        if (*passedFd != -1)
+            close(*passedFd);
+        *passedFd = -1;
+        errno = EPROTO;
+        return -1;
+    }
+    if (h->length > *capacity) {
+        unsigned char *larger = realloc(*payload, h->length);
+        if (larger == NULL)
+            return -1; // errno settato da realloc
+        *payload = larger;
+        *capacity = h->length;
+    }
+    return recv_all(fd, *payload, h->length, NULL);
+}
+
+/* Scrive in out il varint di value e restituisce il n° di byte scritti */
+static size_t put_varint(unsigned char *out, size_t value)
+{
+    size_t n = 0;
+    do {
+        out[n] = value & 0x7f;
+        value >>= 7;
+        if (value != 0)
+            out[n] |= 0x80;
+        n++;
+    } while (value != 0);
+    return n;
+}
+
+/* Legge da in, lungo length byte, un varint in *value. Restituisce il n° di
+   byte letti, oppure 0 se il varint non è valido */
+static size_t get_varint(const unsigned char *in, size_t length, size_t *value)
+{
+    *value = 0;
+    for (size_t n = 0; n < length && n < 10; n++) {
+        *value |= (size_t) (in[n] & 0x7f) << (7 * n);
+        if ((in[n] & 0x80) == 0)
+            return n + 1;
+    }
+    return 0;
+}
+
+/* Scrive in out le differenze tra cur e prev, lunghi length byte, nel
+   formato dei FRAME_DELTA. Restituisce la lunghezza del risultato, oppure -1
+   se supererebbe capacity byte */
+static long encode_delta(const unsigned char *prev, const unsigned char *cur, size_t length,
+                           unsigned char *out, size_t capacity)
+{
+    size_t n = 0, i = 0;
+    while (i < length) {
+        size_t from = i;
+        while (i < length && cur[i] == prev[i])
+            i++;
+        if (i == length)
+            break;
+
+        // I byte da sostituire arrivano fino a FRAME_DELTA_GAP byte invariati consecutivi
+        size_t end = i;
+        while (end < length) {
+            size_t same = end;
+            while (same < length && cur[same] != prev[same])
+                same++;
+            size_t next = same;
+            while (next < length && next - same < FRAME_DELTA_GAP && cur[next] == prev[next])
+                next++;
+            if (next == length || next - same == FRAME_DELTA_GAP) {
+                end = same;
+                break;
+            }
+            end = next;
+        }
+
+        if (n + 20 + (end - i) > capacity) // Due varint occupano al più 20 byte
+            return -1;
+        n += put_varint(out + n, i - from);
+        n += put_varint(out + n, end - i);
+        memcpy(out + n, cur + i, end - i);
+        n += end - i;
+        i = end;
+    }
+    return n;
+}
+
+int frame_encode(frame_encoder_t *e, const unsigned char *cells, unsigned int nrow, unsigned int ncol,
+                 frame_header_t *h, const unsigned char **payload)
+{
+    size_t length = frame_packed_length(nrow, ncol);
+    if (length > e->capacity) {
+        frame_encoder_free(e);
+        e->cells = malloc(length);
+        e->previous = malloc(length);
+        e->delta = malloc(length);
+        if (e->cells == NULL || e->previous == NULL || e->delta == NULL) {
+            frame_encoder_free(e);
+            errno = ENOMEM;
+            return -1;
+        }
+        e->capacity = length;
+    }
+    if (nrow != e->nrow || ncol != e->ncol)
+        e->sinceKey = -1;
+
+    // Le celle del fotogramma precedente diventano quelle di riferimento
+    unsigned char *swap = e->previous;
+    e->previous = e->cells;
+    e->cells = swap;
+    memcpy(e->cells, cells, length);
+    e->nrow = h->nrow = nrow;
+    e->ncol = h->ncol = ncol;
+
+    // Il FRAME_DELTA deve essere più corto del FRAME_FULL
+    long deltaLength = -1;
+    if (e->sinceKey >= 0 && e->sinceKey < FRAME_KEY_INTERVAL)
+        deltaLength = encode_delta(e->previous, e->cells, length, e->delta, length - 1);
+    if (deltaLength >= 0) {
+        h->type = FRAME_DELTA;
+        h->length = deltaLength;
+        *payload = e->delta;
+        e->sinceKey++;
+    }
+    else {
+        h->type = FRAME_FULL;
+        h->length = length;
+        *payload = e->cells;
+        e->sinceKey = 0;
+    }
+    return 0;
+}
+
+void frame_encoder_reset(frame_encoder_t *e)
+{
+    e->sinceKey = -1;
+}
+
+void frame_encoder_free(frame_encoder_t *e)
+{
+    free(e->cells);
+    free(e->previous);
+    free(e->delta);
+    memset(e, 0, sizeof(*e));
+}
+
+int frame_decode(frame_decoder_t *d, const frame_header_t *h, const unsigned char *payload)
+{
+    size_t length = frame_packed_length(h->nrow, h->ncol);
+    if (h->type == FRAME_FULL) {
+        if (h->nrow < 1 || h->ncol < 1 || h->length != length) {
+            errno = EPROTO;
+            return -1;
+        }
+        if (length > d->capacity) {
+            unsigned char *larger = realloc(d->cells, length);
+            if (larger == NULL)
+                return -1; // errno settato da realloc
+            d->cells = larger;
+            d->capacity = length;
+        }
+        memcpy(d->cells, payload, length);
+        d->nrow = h->nrow;
+        d->ncol = h->ncol;
+        return 0;
+    }
+
+    if (h->type != FRAME_DELTA || d->nrow == 0 || h->nrow != d->nrow || h->ncol != d->ncol) {
+        errno = EPROTO;
+        return -1;
+    }
+    size_t i = 0, pos = 0;
+    while (i < h->length) {
+        size_t skip, n, r;
+        if (0 == (r = get_varint(payload + i, h->length - i, &skip)))
+            break;
+        i += r;
+        if (0 == (r = get_varint(payload + i, h->length - i, &n)) || n > h->length - i - r
+            || skip > length - pos || n > length - pos - skip)
+            break;
+        i += r;
+        pos += skip;
+        memcpy(d->cells + pos, payload + i, n);
+        pos += n;
+        i += n;
+    }
+    if (i != h->length) {
+        d->nrow = d->ncol = 0; // Le celle non sono più affidabili fino al prossimo FRAME_FULL
+        errno = EPROTO;
+        return -1;
+    }
+    return 0;
+}
+
+frame_ring_t *frame_ring_create(unsigned int nrow, unsigned int ncol, int *fd)
+{
+    size_t slotLength = frame_packed_length(nrow, ncol);
+    size_t size = sizeof(frame_ring_t) + FRAME_RING_SLOTS * slotLength;
+    if (slotLength > UINT32_MAX) {
+        errno = EOVERFLOW;
+        return NULL;
+    }
+
+    // La dimensione viene sigillata: chi riceve il descrittore non può ridurla sotto la mappatura di wator
+    *fd = memfd_create("wator_frames", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (*fd == -1)
+        return NULL;
+    frame_ring_t *r = MAP_FAILED;
+    if (-1 == ftruncate(*fd, size) || -1 == fcntl(*fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)
+        || MAP_FAILED == (r = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0))) {
+        int error = errno;
+        close(*fd);
+        errno = error;
+        return NULL;
+    }
+
+    // La memoria di un memfd è già a zero: published e le sequenze partono da 0
+    r->magic = FRAME_MAGIC;
+    r->version = FRAME_VERSION;
+    r->slots = FRAME_RING_SLOTS;
+    r->slotLength = slotLength;
+    return r;
+}
+
+const frame_ring_t *frame_ring_map(int fd)
+{
+    struct stat st;
+    frame_ring_t header;
+    if (-1 == fstat(fd, &st))
+        return NULL;
+    if ((size_t) st.st_size < sizeof(frame_ring_t) || pread(fd, &header, sizeof(header), 0) != sizeof(header)
+        || header.magic != FRAME_MAGIC || header.version != FRAME_VERSION || header.slots != FRAME_RING_SLOTS
+        || (size_t) st.st_size < sizeof(frame_ring_t) + (size_t) FRAME_RING_SLOTS * header.slotLength) {
+        errno = EPROTO;
+        return NULL;
+    }
+    const frame_ring_t *r = mmap(NULL, sizeof(frame_ring_t) + (size_t) FRAME_RING_SLOTS * header.slotLength,
+                                 PROT_READ, MAP_SHARED, fd, 0);
+    return r == MAP_FAILED ? NULL : r;
+}
+
+void frame_ring_unmap(const frame_ring_t *r)
+{
+    munmap((void *) r, sizeof(frame_ring_t) + (size_t) FRAME_RING_SLOTS * r->slotLength);
+}
+
+void frame_ring_publish(frame_ring_t *r, planet_t *p, const frame_header_t *h)
+{
+    uint64_t n = r->published; // Scritto solo da chi pubblica
+    frame_slot_t *slot = &r->slot[n % FRAME_RING_SLOTS];
+
+    // Sequenza dispari: chi legge la posizione da ora in poi scarta quello che legge
+    uint64_t sequence = slot->sequence;
+    __atomic_store_n(&slot->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->header = *h;
+    slot->header.magic = FRAME_MAGIC;
+    slot->header.version = FRAME_VERSION;
+    slot->header.type = FRAME_FULL;
+    slot->header.nrow = p->nrow;
+    slot->header.ncol = p->ncol;
+    slot->header.length = r->slotLength;
+    frame_pack(p, RING_CELLS(r, n % FRAME_RING_SLOTS));
+
+    __atomic_store_n(&slot->sequence, sequence + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&r->published, n + 1, __ATOMIC_RELEASE);
+}
+
+bool frame_ring_read(const frame_ring_t *r, uint64_t *last, frame_header_t *h, unsigned char *cells)
+{
+    for (int attempt = 0; attempt < RING_READ_ATTEMPTS; attempt++) {
+        uint64_t n = __atomic_load_n(&r->published, __ATOMIC_ACQUIRE);
+        if (n == *last)
+            return false;
+
+        const frame_slot_t *slot = &r->slot[(n - 1) % FRAME_RING_SLOTS];
+        uint64_t before = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        if (before % 2 == 1)
+            continue; // Chi pubblica ha già fatto il giro dell'anello e sta riscrivendo la posizione
+        *h = slot->header;
+        memcpy(cells, RING_CELLS(r, (n - 1) % FRAME_RING_SLOTS), r->slotLength);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == before) {
+            *last = n;
+            return true;
+        }
+    }
+    return false; // Riprova al prossimo controllo
+}
@@ -0,0 +1,192 @@
+/** \file frame.h
+    \author Giorgio Vinciguerra
+    \date Giugno 2015
+    \copyright Copyright (c) 2015 Giorgio Vinciguerra. All rights reserved.
+    \note  Si dichiara che il contenuto di questo file è in ogni sua parte opera
+           originale dell' autore.
+    \brief File contenente i prototipi delle funzioni che codificano, inviano
+           e ricevono i fotogrammi del pianeta scambiati tra wator e
+           visualizer (il formato è descritto in visualizer.h).
+
+    Le celle di un fotogramma sono impacchettate a 2 bit ciascuna, quattro per
+    byte, per righe: la cella i occupa i bit 2*(i%4) e 2*(i%4)+1 del byte i/4
+    e vale SHARK, FISH o WATER (vedi cell_t).
+*/
+
+#ifndef __FRAME__H
+#define __FRAME__H
+
+#include "wator.h"
+#include "visualizer.h"
+#include <stddef.h>
+#include <stdbool.h>
+
+/** N° massimo di fotogrammi FRAME_DELTA tra due FRAME_FULL */
+#define FRAME_KEY_INTERVAL 64
+
+/** N° minimo di byte invariati che interrompono una sequenza di byte da
+    sostituire in un FRAME_DELTA (più brevi, costerebbero più di una nuova
+    coppia salto-n) */
+#define FRAME_DELTA_GAP 4
+
+/** Lo stato della codifica dei fotogrammi inviati su una connessione. Va
+    inizializzato a zero */
+typedef struct frame_encoder {
+    unsigned char *cells;    // le celle impacchettate dell'ultimo fotogramma codificato
+    unsigned char *previous; // quelle del fotogramma precedente
+    unsigned char *delta;    // il contenuto dell'ultimo FRAME_DELTA
+    size_t capacity;         // la dimensione di ciascuno dei tre buffer
+    unsigned int nrow, ncol;
+    int sinceKey;            // n° di FRAME_DELTA dall'ultimo FRAME_FULL, -1 se il prossimo deve essere FRAME_FULL
+                             // (lo è comunque il primo, perché le dimensioni cambiano)
+} frame_encoder_t;
+
+/** Lo stato della decodifica dei fotogrammi ricevuti su una connessione. Va
+    inizializzato a zero */
+typedef struct frame_decoder {
+    unsigned char *cells;    // le celle impacchettate dell'ultimo fotogramma decodificato
+    size_t capacity;
+    unsigned int nrow, ncol; // 0 se non è ancora arrivato un FRAME_FULL
+} frame_decoder_t;
+
+/** Restituisce il n° di byte occupati dalle celle impacchettate di un
+    pianeta nrow x ncol */
+size_t frame_packed_length(unsigned int nrow, unsigned int ncol);
+
+/** Impacchetta le celle del pianeta p in out, che deve essere lungo almeno
+    frame_packed_length(p->nrow, p->ncol) byte.
+    \param p il pianeta
+    \param out il buffer di destinazione
+ */
+void frame_pack(planet_t *p, unsigned char *out);
+
+/** Spacchetta count celle da in e le scrive, per righe, in cells.
+    \param in le celle impacchettate
+    \param cells il vettore di destinazione
+    \param count il n° di celle
+    \return 0 se tutto e' andato bene
+    \return -1 se una cella non è valida (setta errno a EPROTO)
+ */
+int frame_unpack(const unsigned char *in, cell_t *cells, size_t count);
+
+/** Invia sul socket fd il fotogramma con intestazione h (a cui vengono
+    assegnati magic e versione) e contenuto payload, lungo h->length byte, a
+    partire dal byte *sent (0 per un nuovo fotogramma). Gli invii parziali
+    vengono completati; non genera SIGPIPE. Se fd è non bloccante e il
+    socket è pieno restituisce -1 con errno a EAGAIN: la chiamata va ripetuta
+    con lo stesso fotogramma quando fd torna scrivibile.
+    \param fd il socket
+    \param h l'intestazione
+    \param payload il contenuto
+    \param sent il n° di byte già inviati, aggiornato
+    \return 0 se tutto e' andato bene
+    \return -1 se si e' verificato un errore (setta errno)
+ */
+int frame_send(int fd, frame_header_t *h, const void *payload, size_t *sent);
+
+/** Invia sul socket fd un fotogramma FRAME_RING, con dimensioni nrow x ncol,
+    che porta con sé il descrittore ringFd.
+    \param fd il socket
+    \param nrow n° di righe del pianeta
+    \param ncol n° di colonne del pianeta
+    \param ringFd il descrittore della memoria condivisa (vedi frame_ring_create)
+    \return 0 se tutto e' andato bene
+    \return -1 se si e' verificato un errore (setta errno)
+ */
+int frame_send_ring(int fd, unsigned int nrow, unsigned int ncol, int ringFd);
+
+/** Riceve dal socket fd un fotogramma. L'intestazione viene scritta in h e il
+    contenuto in *payload, che viene ingrandito (con realloc) se *capacity
+    byte non bastano. Se il fotogramma porta con sé un descrittore (vedi
+    FRAME_RING) questo viene scritto in *passedFd, altrimenti *passedFd vale -1.
+    \param fd il socket
+    \param h l'intestazione ricevuta
+    \param payload il buffer del contenuto
+    \param capacity la dimensione del buffer
+    \param passedFd il descrittore ricevuto
+    \return 0 se tutto e' andato bene
+    \return -1 se la connessione è stata chiusa (errno vale 0), se
+            l'intestazione non è valida (errno vale EPROTO) o se si e'
+            verificato un errore (setta errno)
+ */
+int frame_recv(int fd, frame_header_t *h, unsigned char **payload, size_t *capacity, int *passedFd);
+
+/** Codifica le celle impacchettate (vedi frame_pack) di un pianeta nrow x
+    ncol nel fotogramma successivo di e: un FRAME_FULL se è il primo dopo
+    frame_encoder_reset, se le dimensioni sono cambiate, ogni FRAME_KEY_INTERVAL fotogrammi o se le celle cambiate sono troppe
+    perché convenga un FRAME_DELTA; altrimenti un FRAME_DELTA.
+    \param e lo stato della codifica
+    \param cells le celle impacchettate
+    \param nrow n° di righe del pianeta
+    \param ncol n° di colonne del pianeta
+    \param h l'intestazione, di cui vengono assegnati tipo, dimensioni e length
+    \param payload il contenuto del fotogramma, valido fino alla prossima
+           chiamata su e
+    \return 0 se tutto e' andato bene
+    \return -1 se si e' verificato un errore (setta errno)
+ */
+int frame_encode(frame_encoder_t *e, const unsigned char *cells, unsigned int nrow, unsigned int ncol,
+                 frame_header_t *h, const unsigned char **payload);
+
+/** Fa sì che il prossimo fotogramma codificato da e sia un FRAME_FULL. Va
+    chiamata quando la connessione cambia o un invio non va a buon fine. */
+void frame_encoder_reset(frame_encoder_t *e);
+
+/** Libera la memoria di e, che torna come appena inizializzato a zero. */
+void frame_encoder_free(frame_encoder_t *e);
+
+/** Applica il fotogramma ricevuto (h, payload) alle celle di d.
+    \param d lo stato della decodifica
+    \param h l'intestazione
+    \param payload il contenuto
+    \return 0 se tutto e' andato bene: d->cells contiene le celle impacchettate
+            del pianeta d->nrow x d->ncol
+    \return -1 se il fotogramma non è valido o non segue un FRAME_FULL con le
+            stesse dimensioni (errno vale EPROTO), o se si e' verificato un
+            errore (setta errno)
+ */
+int frame_decode(frame_decoder_t *d, const frame_header_t *h, const unsigned char *payload);
+
+/** Crea in memoria condivisa (un memfd di dimensione fissa) l'anello dei
+    fotogrammi di un pianeta nrow x ncol.
+    \param nrow n° di righe del pianeta
+    \param ncol n° di colonne del pianeta
+    \param fd il descrittore della memoria condivisa, da passare al visualizer
+    \return l'anello, mappato in lettura e scrittura, oppure NULL (errno viene
+            settato) in caso di errore
+ */
+frame_ring_t *frame_ring_create(unsigned int nrow, unsigned int ncol, int *fd);
+
+/** Mappa in sola lettura l'anello contenuto nella memoria condivisa fd, dopo
+    averne controllato dimensione e intestazione.
+    \param fd il descrittore ricevuto con FRAME_RING
+    \return l'anello, oppure NULL (errno viene settato, EPROTO se l'anello non
+            è valido) in caso di errore
+ */
+const frame_ring_t *frame_ring_map(int fd);
+
+/** Libera la mappatura dell'anello r, creato o mappato dalle funzioni
+    precedenti. */
+void frame_ring_unmap(const frame_ring_t *r);
+
+/** Scrive il pianeta p nella posizione successiva dell'anello r e la
+    pubblica. Non esegue chiamate di sistema e non attende chi legge.
+    \param r l'anello
+    \param p il pianeta, delle dimensioni dell'anello
+    \param h l'intestazione, di cui vengono usati chronon, nf e ns
+ */
+void frame_ring_publish(frame_ring_t *r, planet_t *p, const frame_header_t *h);
+
+/** Copia l'ultimo fotogramma pubblicato in r, se è più recente di quello
+    letto in precedenza.
+    \param r l'anello
+    \param last il n° dei fotogrammi pubblicati alla lettura precedente
+           (inizialmente 0), aggiornato se viene letto un fotogramma
+    \param h l'intestazione del fotogramma letto
+    \param cells le celle impacchettate del fotogramma letto, lungo almeno
+           r->slotLength byte
+    \return true se è stato letto un nuovo fotogramma, altrimenti false
+ */
+bool frame_ring_read(const frame_ring_t *r, uint64_t *last, frame_header_t *h, unsigned char *cells);
+
+#endif
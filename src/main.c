@@ -5,8 +5,11 @@
     \note  Si dichiara che il contenuto di questo file è in ogni sua parte opera
            originale dell' autore.
     \brief File che attiva un server, un thread dispatcher, un thread collector
-           e n thread worker (definiti in farm.c) e lancia il processo
-           visualizer.
+           e n thread worker (definiti in farm.c) oppure un pool di n worker
+           (definito in pool.c) e lancia il processo visualizer. Con l'opzione
+           -b la simulazione gira invece senza server, visualizer, socket di
+           controllo né checkpoint, così che le misure riguardino solo il
+           calcolo.
 
     Questo file verrà compilato nell'eseguibile wator. Il processo wator si
     occupa della creazione della struttura a farm per la simulazione, e della
@@ -14,6 +17,14 @@
  */
 
 #include "farm.h"
+#include "pool.h"
+#include "affinity.h"
+#include "wave.h"
+#include "phases.h"
+#include "trace.h"
+#include "control.h"
+#include "frame.h"
+#include "export.h"
 #include "wator.h"
 #include "utils.h"
 #include "visualizer.h"
@@ -24,6 +35,7 @@
 #include <unistd.h>
 #include <signal.h>
 #include <libgen.h>
+#include <time.h>
 #include <pthread.h>
 #include <sys/un.h>
 #include <sys/wait.h>
@@ -41,22 +53,58 @@
     pianeta quando l'opzione -v non è specificata */
 #define CHRON_DEF 4
 
-/** Intervallo di default, misurato in millisecondi, tra il calcolo un chronon e
-    l'altro quando l'opzione -d non è specificata */
+/** Intervallo minimo di default, misurato in millisecondi, tra la conclusione
+    di un chronon e quella del successivo quando l'opzione -d non è specificata
+    (0 non limita la velocità della simulazione). -d N è un intervallo, non
+    una frequenza: la simulazione procede al più a 1000/N chronon al secondo */
 #define CHRON_DELAY 0
 
-/** Numero massimo di connessioni contemporanee ammesse sul socket */
-#define SOCKET_MAXCONN 1
+/** Intervallo di default, misurato in chronon, tra un ribilanciamento della
+    suddivisione del pianeta e l'altro quando l'opzione -r non è specificata */
+#define REBALANCE_DEF 64
+
+/** Numero massimo di default di chronon di una passata del motore a fronte
+    d'onda quando l'opzione -k non è specificata */
+#define WAVE_DEF 16
+
+/** Numero di default di chronon della modalità batch quando né l'opzione -c
+    né l'opzione -l sono specificate */
+#define BATCH_CHRONONS_DEF 1000
+
+/** Numero massimo di connessioni in attesa sul socket: i visualizer connessi
+    contemporaneamente possono essere quanti si vuole (vedi export.h) */
+#define SOCKET_MAXCONN 16
+
+/** I motori di esecuzione della simulazione, scelti con l'opzione -e */
+typedef enum {ENGINE_FARM, ENGINE_POOL, ENGINE_WAVE} engine_t;
 
 // Dichiarazione delle variabili extern di farm.h
 volatile wator_t *wator;
 volatile bool mustTerminateFlag = false;
+volatile bool mustStopEngine = false;
+volatile int requestedWorkers = 0;
+pthread_mutex_t engineMutex = PTHREAD_MUTEX_INITIALIZER;
 volatile int visualizerSocket = -1;
-volatile int visualizerConnectionFd = -1;
+frame_ring_t *frameRing = NULL;
+int frameRingFd = -1;
 volatile long chrInterval = CHRON_DEF;
+long rebalanceInterval = REBALANCE_DEF;
+long waveChronons = WAVE_DEF;
 volatile useconds_t chronDelay = CHRON_DELAY;
 volatile queue_t *tasksQueue;
-int totalWorkers = NWORK_DEF; // Può non essere volatile visto che non cambia durante la simulazione
+int totalWorkers = NWORK_DEF; // Può non essere volatile visto che cambia solo a motore fermo
+int tileRows = 0, tileCols = 0;
+long maxChronons = 0;
+
+// Il motore di esecuzione e i suoi thread
+static engine_t engine = ENGINE_FARM;
+static bool pinThreads = false;
+static bool autoTiles;  // true se la dimensione dei riquadri non è stata data con -t
+static pthread_t dispatcher, collector, *workersArray;
+static bool engineRunning = false;
+static bool engineStarted = false;
+static struct timespec startTime; // la creazione dei thread del primo motore
+static long startChronon;         // il chronon a quell'istante
 
 /** Realizza la funzionalità di checkpointing: salva lo stato corrente della
     simulazione in un file wator.check nella stessa cartella dell'eseguibile e
@@ -75,6 +123,113 @@ void checkpoint()
     alarm(SEC);
 }
 
+/** Prepara il motore di esecuzione per totalWorkers worker e ne crea i
+    thread, che ereditano la mask dei segnali del thread chiamante.
+ */
+static void start_engine()
+{
+    int retval;
+    if (autoTiles)
+        tileRows = tileCols = 0; // La dimensione dei riquadri dipende dal n° di worker
+    setup_farm();
+    if (pinThreads) {
+        setup_affinity(totalWorkers);
+        print_topology(stderr);
+        // Nel farm ogni worker prende riquadri qualsiasi: nessuna fascia di righe è sua
+        if (engine != ENGINE_FARM && -1 == place_planet(wator->plan))
+            perror("Impossibile distribuire il pianeta sui nodi dei worker");
+    }
+    if (engine == ENGINE_FARM) {
+        // In coda ci sono al più i task di un batch
+        NOT_NULL_OR_FAIL(create_queue(partition_max_batch_size(planetPartition)), tasksQueue, "Impossibile creare la coda dei task.");
+    }
+    else if (engine == ENGINE_POOL)
+        setup_pool();
+    else
+        setup_wave();
+
+    // Le prestazioni si misurano dalla creazione dei primi thread, senza la preparazione del motore
+    if (!engineStarted) {
+        engineStarted = true;
+        startChronon = wator->chronon;
+        clock_gettime(CLOCK_MONOTONIC, &startTime);
+    }
+
+    // Generazione dei worker...
+    NOT_NULL_OR_FAIL(malloc(totalWorkers * sizeof(pthread_t)), workersArray, "Impossibile creare i thread worker");
+    void *(*workerLoop)(void *) = engine == ENGINE_FARM ? worker_loop : engine == ENGINE_POOL ? pool_worker_loop : wave_worker_loop;
+    pthread_attr_t attr; // Lega il thread al suo processore, se è stato richiesto con -a
+    for (int i = 0; i < totalWorkers; i++) {
+        int *args = malloc(sizeof(int)); *args = i;
+        affinity_thread_attr(&attr, i);
+        SC_OR_FAIL(pthread_create(&workersArray[i], &attr, workerLoop, args), retval, "Impossibile creare un thread worker");
+        pthread_attr_destroy(&attr);
+    }
+    // ... del dispatcher e del collector (il pool non ne ha bisogno)
+    if (engine == ENGINE_FARM) {
+        affinity_thread_attr(&attr, -1);
+        SC_OR_FAIL(pthread_create(&dispatcher, &attr, dispatcher_loop, NULL), retval, "Impossibile creare il thread dispatcher");
+        SC_OR_FAIL(pthread_create(&collector, &attr, collector_loop, NULL), retval, "Impossibile creare il thread collector");
+        pthread_attr_destroy(&attr);
+    }
+    engineRunning = true;
+}
+
+/** Attende la terminazione dei thread del motore, che avviene alla fine del
+    chronon corrente se è stato impostato mustTerminateFlag o mustStopEngine.
+ */
+static void stop_engine()
+{
+    int retval;
+    if (!engineRunning)
+        return;
+    mustStopEngine = true;
+    control_wake(); // Il motore potrebbe essere in pausa
+    if (engine == ENGINE_FARM) {
+        SC_OR_FAIL(pthread_join(collector, NULL), retval, "Errore nell'attesa della terminazione del collector");
+        SC_OR_FAIL(pthread_join(dispatcher, NULL), retval, "Errore nell'attesa della terminazione del dispatcher");
+    }
+    for (int i = 0; i < totalWorkers; i++)
+        SC_OR_FAIL(pthread_join(workersArray[i], NULL), retval, "Errore nell'attesa della terminazione di un worker");
+    free(workersArray);
+    mustStopEngine = false;
+    engineRunning = false;
+}
+
+/** Libera le strutture del motore fermato da stop_engine. Se restarting è
+    true la suddivisione del pianeta resta disponibile per start_engine. */
+static void teardown_engine(bool restarting)
+{
+    if (engine == ENGINE_FARM) {
+        free_queue(tasksQueue);
+        tasksQueue = NULL;
+    }
+    else if (engine == ENGINE_POOL)
+        teardown_pool();
+    else
+        teardown_wave();
+    teardown_farm(restarting);
+    teardown_affinity();
+}
+
+/** Riavvia il motore con workers worker alla fine del chronon corrente. Non
+    fa nulla se il numero non cambia o se la simulazione sta terminando.
+ */
+static void resize_engine(int workers)
+{
+    if (workers < 1 || workers == totalWorkers || mustTerminateFlag)
+        return;
+    stop_engine();
+    if (mustTerminateFlag)
+        return; // La simulazione è terminata mentre il motore si fermava
+    pthread_mutex_lock(&engineMutex);
+    teardown_engine(true);
+    fprintf(stderr, "Chronon %ld: worker da %d a %d\n", (long) wator->chronon, totalWorkers, workers);
+    totalWorkers = workers;
+    start_engine();
+    pthread_mutex_unlock(&engineMutex);
+}
+
 int main(int argc, char *argv[])
 {
     // Prova a rimuovere i file wator_worker_wid delle precedenti simulazioni
@@ -83,7 +238,13 @@ int main(int argc, char *argv[])
     /* =========================================================================
         CONTROLLO DEI PARAMETRI e delle condizioni per l'avvio del programma
      */
-    char c, *planetFile, *dumpFile = NULL;
+    char c, *planetFile, *dumpFile = NULL, *traceFile = NULL;
+    bool useHalo = false;
+    bool sharedFrames = false;
+    bool seedGiven = false;
+    bool batchMode = false;
+    long timeBudget = 0;
+    unsigned long seed = DEFAULT_SEED;
 
     if (argc < 2)
         print_fatal_error("Nessun file di input.");
@@ -94,18 +255,51 @@ int main(int argc, char *argv[])
         print_fatal_error("File del pianeta '%s' non trovato o permessi insufficienti.", planetFile);
 
     optind = 2;
-    while ((c = getopt(argc, argv, ":n:v:f:d:")) != -1)
+    while ((c = getopt(argc, argv, ":n:v:f:d:gas:e:t:r:k:bc:l:x:m")) != -1)
         switch (c) {
             case 'f': dumpFile = optarg; break;
+            case 'x': traceFile = optarg; break;
+            case 'g': useHalo = true; break;
+            case 'm': sharedFrames = true; break;
+            case 'a': pinThreads = true; break;
+            case 'b': batchMode = true; break;
+            case 'c': STRTOUL_OR_FAIL(optarg, maxChronons); break;
+            case 'l': STRTOUL_OR_FAIL(optarg, timeBudget); break;
+            case 's': STRTOUL_OR_FAIL(optarg, seed); seedGiven = true; break;
+            case 'e':
+                if (strcmp(optarg, "farm") == 0)
+                    engine = ENGINE_FARM;
+                else if (strcmp(optarg, "pool") == 0)
+                    engine = ENGINE_POOL;
+                else if (strcmp(optarg, "wave") == 0)
+                    engine = ENGINE_WAVE;
+                else
+                    print_fatal_error("Motore di esecuzione '%s' sconosciuto (farm, pool o wave).", optarg);
+                break;
+            case 't': // Riquadri di AxL celle, oppure di LxL celle
+                if (sscanf(optarg, "%dx%d", &tileRows, &tileCols) == 1)
+                    tileCols = tileRows;
+                if (tileRows < 1 || tileCols < 1)
+                    print_fatal_error("Dimensione dei riquadri '%s' non valida (L oppure AxL).", optarg);
+                break;
             case 'n': STRTOUL_OR_FAIL(optarg, totalWorkers); break;
             case 'v': STRTOUL_OR_FAIL(optarg, chrInterval); break;
-            case 'd': STRTOUL_OR_FAIL(optarg, chronDelay); chronDelay *= 1000.0; break;
+            case 'r': STRTOUL_OR_FAIL(optarg, rebalanceInterval); break;
+            case 'k': STRTOUL_OR_FAIL(optarg, waveChronons); break;
+            case 'd': STRTOUL_OR_FAIL(optarg, chronDelay); chronDelay *= 1000.0; break; // Millisecondi tra due chronon
             case ':': print_fatal_error("L'opzione -%c richiede un argomento.", optopt);
             case '?': print_fatal_error("Opzione -%c non riconosciuta.", optopt);
             default:  print_fatal_error("Mi aspettavo un'opzione ma ho ricevuto %c.", c);
         }
     if (optind < argc)
         print_fatal_error("Sono stati forniti troppi argomenti.");
+    if (batchMode && sharedFrames)
+        print_fatal_error("L'opzione -m non è ammessa in modalità batch (-b).");
+    if (!batchMode && (maxChronons > 0 || timeBudget > 0))
+        print_fatal_error("Le opzioni -c e -l sono ammesse solo in modalità batch (-b).");
+    if (batchMode && maxChronons == 0 && timeBudget == 0)
+        maxChronons = BATCH_CHRONONS_DEF;
+    autoTiles = tileRows == 0;
 
     /* =========================================================================
                     CARICAMENTO SIMULAZIONE WATOR
@@ -116,36 +310,56 @@ int main(int argc, char *argv[])
         print_fatal_error("Impossibile caricare la simulazione.");
     if (wator->plan->nrow < 5 || wator->plan->ncol < 5)
         print_fatal_error("Il pianeta non ha un numero sufficiente di righe o colonne");
+    if (seedGiven)
+        wator->seed = seed; // Il seme da riga di comando prevale su quello di wator.conf
+    if (useHalo && -1 == set_planet_halo(wator->plan, true))
+        print_fatal_error("Impossibile aggiungere il bordo fantasma al pianeta.");
 
     /* =========================================================================
                 CREAZIONE DEL SOCKET e AVVIO DEL VISUALIZER
      */
 
-    int visualizerPid;
+    int visualizerPid = -1;
     char tmpPath[sizeof(SOCKET_PATH)]; // Necessario perché in alcune implementazioni dirname() modifica il parametro passato
     struct sockaddr_un sockaddr = {.sun_family = AF_UNIX};
     strncpy(tmpPath, SOCKET_PATH, sizeof(SOCKET_PATH));
     strncpy(sockaddr.sun_path, SOCKET_PATH, sizeof(sockaddr.sun_path));
-    unlink(SOCKET_PATH);
-    mkdir(dirname(tmpPath), 0666);
 
-    SC_OR_FAIL(socket(AF_UNIX, SOCK_STREAM, 0), visualizerSocket, "Errore nella creazione del socket");
-    SC_OR_FAIL(bind(visualizerSocket, (struct sockaddr *) &sockaddr, sizeof(sockaddr)), retval, "Errore nell'assegnamento di un nome al socket");
-    SC_OR_FAIL(fork(), visualizerPid, "Errore nella creazione del visualizer");
+    // In modalità batch visualizerSocket resta a -1 e i chronon non vengono inviati
+    if (!batchMode) {
+        unlink(SOCKET_PATH);
+        mkdir(dirname(tmpPath), 0666);
+
+        // Il visualizer non eredita il socket: altrimenti, riconnettendosi alla chiusura, resterebbe in attesa su sé stesso
+        SC_OR_FAIL(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0), visualizerSocket, "Errore nella creazione del socket");
+        SC_OR_FAIL(bind(visualizerSocket, (struct sockaddr *) &sockaddr, sizeof(sockaddr)), retval, "Errore nell'assegnamento di un nome al socket");
+        SC_OR_FAIL(fork(), visualizerPid, "Errore nella creazione del visualizer");
 
-    // Non riceve segnali SIGPIPE se un client/server chiude la connessione in anticipo
-    if (SIG_ERR == signal(SIGPIPE, SIG_IGN))
-        print_fatal_error("Impossibile gestire i segnali");
+        // Non riceve segnali SIGPIPE se un client/server chiude la connessione in anticipo
+        if (SIG_ERR == signal(SIGPIPE, SIG_IGN))
+            print_fatal_error("Impossibile gestire i segnali");
 
-    if (visualizerPid == 0)
-        SC_OR_FAIL(execlp("./visualizer", "visualizer", dumpFile ? dumpFile : NULL, NULL), retval, "L'eseguibile visualizer non può essere lanciato");
-    SC_OR_FAIL(listen(visualizerSocket, SOCKET_MAXCONN), retval, "Errore in listen");
+        if (visualizerPid == 0)
+            SC_OR_FAIL(execlp("./visualizer", "visualizer", dumpFile ? dumpFile : NULL, NULL), retval, "L'eseguibile visualizer non può essere lanciato");
+        SC_OR_FAIL(listen(visualizerSocket, SOCKET_MAXCONN), retval, "Errore in listen");
+
+        // Con -m i fotogrammi passano per un anello in memoria condivisa, consegnato al visualizer sul socket
+        if (sharedFrames) {
+            NOT_NULL_OR_FAIL(frame_ring_create(wator->plan->nrow, wator->plan->ncol, &frameRingFd), frameRing,
+                             "Impossibile creare la memoria condivisa dei fotogrammi");
+        }
+    }
 
     /* =========================================================================
                     CREAZIONE DELLA STRUTTURA FARM
      */
 
-    tasksQueue = create_queue();
+    if (totalWorkers < 1)
+        print_fatal_error("Serve almeno un worker.");
+    if (engine == ENGINE_WAVE && waveChronons < 1)
+        print_fatal_error("Una passata deve durare almeno un chronon.");
+    if (traceFile)
+        setup_trace();
 
     // Imposta una mask che i nuovi thread erediteranno (la mask del thread corrente verrà ripristinata)
     sigset_t mainThreadMask, otherThreadMask;
@@ -154,27 +368,45 @@ int main(int argc, char *argv[])
     sigaddset(&otherThreadMask, SIGTERM);
     sigaddset(&otherThreadMask, SIGUSR1);
     sigaddset(&otherThreadMask, SIGALRM);
+    sigaddset(&otherThreadMask, SIGTTIN);
+    sigaddset(&otherThreadMask, SIGTTOU);
     SC_OR_FAIL(pthread_sigmask(SIG_SETMASK, &otherThreadMask, &mainThreadMask), retval, "Impossibile mascherare i segnali");
 
-    // Tutti i controlli hanno avuto successo, generazione dei worker...
-    pthread_t dispatcher, collector;
-    pthread_t *workersArray = (pthread_t *) malloc(totalWorkers * sizeof(pthread_t));
-    for (int i = 0; i < totalWorkers; i++) {
-        int *args = malloc(sizeof(int)); *args = i;
-        SC_OR_FAIL(pthread_create(&workersArray[i], NULL, worker_loop, args), retval, "Impossibile creare un thread worker");
-    }
-    // ... del dispatcher e del collector
-    SC_OR_FAIL(pthread_create(&dispatcher, NULL, dispatcher_loop, NULL), retval, "Impossibile creare il thread dispatcher");
-    SC_OR_FAIL(pthread_create(&collector, NULL, collector_loop, NULL), retval, "Impossibile creare il thread collector");
+    // Tutti i controlli hanno avuto successo, generazione dei thread
+    struct timespec budgetStart, endTime; // Il budget di -l comprende anche la preparazione del motore
+    clock_gettime(CLOCK_MONOTONIC, &budgetStart);
+    if (!batchMode)
+        start_export(); // Eredita la mask dei segnali dei worker
+    start_engine();
+    if (!batchMode)
+        start_control(); // Eredita la mask dei segnali dei worker
 
     /* =========================================================================
                     GESTIONE DEI SEGNALI del main thread
      */
 
-    checkpoint(); // Effettua il 1° checkpoint e avvia l'allarme per il prossimo
+    if (!batchMode)
+        checkpoint(); // Effettua il 1° checkpoint e avvia l'allarme per il prossimo
     int sig;
     while (!mustTerminateFlag) {
-        sigwait(&otherThreadMask, &sig);
+        if (timeBudget > 0) {
+            // Attende un segnale per al più il tempo che resta prima di terminare
+            struct timespec now, timeout = {0, 0};
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            timeout.tv_sec = budgetStart.tv_sec + timeBudget - now.tv_sec;
+            timeout.tv_nsec = budgetStart.tv_nsec - now.tv_nsec;
+            if (timeout.tv_nsec < 0) {
+                timeout.tv_sec--;
+                timeout.tv_nsec += 1000000000L;
+            }
+            if (timeout.tv_sec < 0 || (sig = sigtimedwait(&otherThreadMask, NULL, &timeout)) == -1) {
+                if (timeout.tv_sec < 0 || errno == EAGAIN)
+                    mustTerminateFlag = true; // Budget di tempo esaurito
+                continue;
+            }
+        }
+        else
+            sigwait(&otherThreadMask, &sig);
         DEBUG_PRINTF("Segnale ricevuto %d\n", sig);
         switch (sig) {
             case SIGINT:
@@ -184,7 +416,17 @@ int main(int argc, char *argv[])
 
             case SIGALRM:
             case SIGUSR1:
-                checkpoint();
+                if (!batchMode) // Il pianeta finale viene comunque stampato
+                    checkpoint();
+                break;
+
+            case SIGTTIN: // Un worker in più, o il n° richiesto dal socket di controllo
+                resize_engine(requestedWorkers > 0 ? requestedWorkers : totalWorkers + 1);
+                requestedWorkers = 0;
+                break;
+
+            case SIGTTOU: // Un worker in meno
+                resize_engine(totalWorkers - 1);
                 break;
 
             default:
@@ -198,17 +440,44 @@ int main(int argc, char *argv[])
      */
 
     DEBUG_PRINT("Avvio terminazione gentile...\n");
-    SC_OR_FAIL(pthread_join(collector, NULL), retval, "Errore nell'attesa della terminazione del collector");
-    SC_OR_FAIL(pthread_join(dispatcher, NULL), retval, "Errore nell'attesa della terminazione del dispatcher");
-
-    for (int i = 0; i < totalWorkers; i++)
-        SC_OR_FAIL(pthread_join(workersArray[i], NULL), retval, "Errore nell'attesa della terminazione di un worker");
-    free(workersArray);
-
-    close(visualizerSocket);
-    kill(visualizerPid, SIGUSR2);
-    waitpid(visualizerPid, &retval, 0);
-    unlink(SOCKET_PATH);
+    stop_control();
+    stop_engine();
+    clock_gettime(CLOCK_MONOTONIC, &endTime);
+    if (!batchMode)
+        stop_export();
+    if (engine == ENGINE_POOL)
+        print_pool_steals(stderr);
+    teardown_engine(false);
+    print_phases(stderr, wator->chronon - startChronon);
+    if (traceFile && -1 == save_trace(traceFile))
+        perror("Impossibile salvare la cronologia");
+
+    if (batchMode) {
+        // Stampa il pianeta finale e il riepilogo delle prestazioni
+        FILE *out = dumpFile ? fopen(dumpFile, "w") : stdout;
+        if (out == NULL)
+            perror("Impossibile salvare il pianeta finale");
+        else {
+            print_planet(out, wator->plan);
+            if (out != stdout)
+                fclose(out);
+        }
+        double elapsed = (endTime.tv_sec - startTime.tv_sec) + (endTime.tv_nsec - startTime.tv_nsec) / 1e9;
+        long chronons = wator->chronon - startChronon;
+        double cells = (double) chronons * wator->plan->nrow * wator->plan->ncol;
+        fprintf(stderr, "Chronon eseguiti: %ld in %.3f s (%.1f chronon/s, %.4g celle/s)\n",
+                chronons, elapsed, chronons / elapsed, cells / elapsed);
+    }
+    else {
+        close(visualizerSocket);
+        kill(visualizerPid, SIGUSR2);
+        waitpid(visualizerPid, &retval, 0);
+        unlink(SOCKET_PATH);
+        if (frameRing != NULL) {
+            frame_ring_unmap(frameRing);
+            close(frameRingFd);
+        }
+    }
     DEBUG_PRINT("Simulazione terminata con successo\n");
     return EXIT_SUCCESS;
 }
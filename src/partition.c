@@ -0,0 +1,227 @@
+/** \file partition.c
+    \author Giorgio Vinciguerra
+    \date Giugno 2015
+    \copyright Copyright (c) 2015 Giorgio Vinciguerra. All rights reserved.
+    \note  Si dichiara che il contenuto di questo file è in ogni sua parte opera
+           originale dell' autore.
+    \brief File contenente l'implementazione delle funzioni per la
+           suddivisione del pianeta in rettangoli aggiornabili in parallelo.
+*/
+
+#include "partition.h"
+#include "utils.h"
+#include <errno.h>
+#include <stdlib.h>
+
+/* Numero di riquadri di lato side lungo una dimensione di n celle: pari,
+   così che il primo e l'ultimo riquadro (vicini attraverso il bordo del
+   pianeta) abbiano colori diversi, oppure 1 se non ce ne stanno due */
+static int tiles_along(int n, int side)
+{
+    if (side < PARTITION_GAP)
+        side = PARTITION_GAP;
+    int tiles = n / side;
+    if (tiles % 2 == 1)
+        tiles--;
+    return tiles < 2 ? 1 : tiles;
+}
+
+/* Assegna al riquadro (i,j) le righe [rowCuts[i], rowCuts[i+1]) e le colonne
+   [colCuts[j], colCuts[j+1]). Il colore del riquadro è il suo batch; i
+   rettangoli che non esistono ancora vengono allocati */
+static void place_tiles(partition_t *part, const int *rowCuts, const int *colCuts)
+{
+    int filled[PARTITION_MAX_BATCHES] = {0};
+    for (int i = 0; i < part->tilesY; i++)
+        for (int j = 0; j < part->tilesX; j++) {
+            int b = tile_batch(part, i, j);
+            rect_t **tile = &part->batch[b][filled[b]++];
+            if (*tile == NULL)
+                *tile = part->tiles[i * part->tilesX + j] =
+                    make_rect(rowCuts[i], colCuts[j], colCuts[j + 1] - colCuts[j], rowCuts[i + 1] - rowCuts[i]);
+            else {
+                (*tile)->fromRow = rowCuts[i];
+                (*tile)->fromCol = colCuts[j];
+                (*tile)->rows = rowCuts[i + 1] - rowCuts[i];
+                (*tile)->cols = colCuts[j + 1] - colCuts[j];
+            }
+        }
+}
+
+partition_t *new_partition(int nrow, int ncol, int tileRows, int tileCols)
+{
+    if (nrow < 5 || ncol < 5 || tileRows < 1 || tileCols < 1) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    partition_t *part = calloc(1, sizeof(partition_t));
+    if (part == NULL)
+        return NULL;
+    part->tilesY = tiles_along(nrow, tileRows);
+    part->tilesX = tiles_along(ncol, tileCols);
+    int colorsY = part->tilesY > 1 ? 2 : 1;
+    int colorsX = part->tilesX > 1 ? 2 : 1;
+    DEBUG_PRINTF("tiles=%dx%d, colors=%d\n", part->tilesY, part->tilesX, colorsY * colorsX);
+
+    part->numBatches = colorsY * colorsX;
+    part->totalRects = part->tilesY * part->tilesX;
+    part->rects = calloc(part->totalRects, sizeof(rect_t *));
+    part->tiles = calloc(part->totalRects, sizeof(rect_t *));
+    int *rowCuts = malloc((part->tilesY + 1) * sizeof(int));
+    int *colCuts = malloc((part->tilesX + 1) * sizeof(int));
+    if (part->rects == NULL || part->tiles == NULL || rowCuts == NULL || colCuts == NULL) {
+        free(part->rects);
+        free(part->tiles);
+        free(part);
+        free(rowCuts);
+        free(colCuts);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    // Conta i riquadri di ogni colore...
+    for (int i = 0; i < part->tilesY; i++)
+        for (int j = 0; j < part->tilesX; j++)
+            part->batchSize[tile_batch(part, i, j)]++;
+    part->batch[0] = part->rects;
+    for (int b = 1; b < part->numBatches; b++)
+        part->batch[b] = part->batch[b - 1] + part->batchSize[b - 1];
+
+    // ... poi li crea. I lati dei riquadri differiscono al più di una cella
+    for (int i = 0; i <= part->tilesY; i++)
+        rowCuts[i] = (long) i * nrow / part->tilesY;
+    for (int j = 0; j <= part->tilesX; j++)
+        colCuts[j] = (long) j * ncol / part->tilesX;
+    place_tiles(part, rowCuts, colCuts);
+    free(rowCuts);
+    free(colCuts);
+
+    for (int i = 0; i < part->totalRects; i++)
+        if (part->rects[i] == NULL) {
+            free_partition(part);
+            errno = ENOMEM;
+            return NULL;
+        }
+
+    return part;
+}
+
+/* Calcola in cuts i confini di tiles fasce di una dimensione di n celle, in
+   modo che la somma dei pesi weight di ogni fascia sia circa la stessa e che
+   ogni fascia sia larga almeno PARTITION_GAP */
+static void balanced_cuts(const long *weight, int n, int tiles, int *cuts)
+{
+    long total = 0;
+    for (int k = 0; k < n; k++)
+        total += weight[k];
+
+    long sum = 0; // la somma dei pesi delle prime k celle
+    int k = 0;
+    cuts[0] = 0;
+    cuts[tiles] = n;
+    for (int t = 1; t < tiles; t++) {
+        long target = total * t / tiles;
+        while (k < n && sum + weight[k] / 2 < target)
+            sum += weight[k++];
+
+        // Lascia spazio per questa fascia e per quelle che restano
+        int cut = k;
+        if (cut < cuts[t - 1] + PARTITION_GAP)
+            cut = cuts[t - 1] + PARTITION_GAP;
+        if (cut > n - (tiles - t) * PARTITION_GAP)
+            cut = n - (tiles - t) * PARTITION_GAP;
+        for (; k < cut; k++)
+            sum += weight[k];
+        for (; k > cut; k--)
+            sum -= weight[k - 1];
+        cuts[t] = cut;
+    }
+}
+
+int rebalance_partition(partition_t *part, planet_t *p)
+{
+    if (part == NULL || p == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (part->tilesY == 1 && part->tilesX == 1)
+        return 0;
+
+    const int nrow = p->nrow, ncol = p->ncol;
+    long *rowWeight = malloc(nrow * sizeof(long));
+    long *colWeight = malloc(ncol * sizeof(long));
+    int *rowCuts = malloc((part->tilesY + 1) * sizeof(int));
+    int *colCuts = malloc((part->tilesX + 1) * sizeof(int));
+    if (rowWeight == NULL || colWeight == NULL || rowCuts == NULL || colCuts == NULL) {
+        free(rowWeight);
+        free(colWeight);
+        free(rowCuts);
+        free(colCuts);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (int c = 0; c < ncol; c++)
+        colWeight[c] = nrow;
+    for (int r = 0; r < nrow; r++) {
+        const cell_t *rowCells = &p->wcells[CELL_INDEX(p, r, 0)];
+        rowWeight[r] = ncol;
+        for (int c = 0; c < ncol; c++)
+            if (rowCells[c] != WATER) {
+                rowWeight[r] += PARTITION_ANIMAL_COST - 1;
+                colWeight[c] += PARTITION_ANIMAL_COST - 1;
+            }
+    }
+
+    balanced_cuts(rowWeight, nrow, part->tilesY, rowCuts);
+    balanced_cuts(colWeight, ncol, part->tilesX, colCuts);
+    place_tiles(part, rowCuts, colCuts);
+
+    free(rowWeight);
+    free(colWeight);
+    free(rowCuts);
+    free(colCuts);
+    return 0;
+}
+
+int partition_tile_side(int nrow, int ncol, int workers)
+{
+    int side = PARTITION_TILE_SIDE;
+    while (side / 2 >= PARTITION_GAP) {
+        int tilesY = tiles_along(nrow, side);
+        int tilesX = tiles_along(ncol, side);
+        int batches = (tilesY > 1 ? 2 : 1) * (tilesX > 1 ? 2 : 1);
+        if (tilesY * tilesX / batches >= workers)
+            break;
+        side /= 2;
+    }
+    return side;
+}
+
+int tile_batch(partition_t *part, int i, int j)
+{
+    int colorsY = part->tilesY > 1 ? 2 : 1;
+    int colorsX = part->tilesX > 1 ? 2 : 1;
+    return (i % colorsY) * colorsX + j % colorsX;
+}
+
+int partition_max_batch_size(partition_t *part)
+{
+    int max = 0;
+    for (int b = 0; b < part->numBatches; b++)
+        if (part->batchSize[b] > max)
+            max = part->batchSize[b];
+    return max;
+}
+
+void free_partition(partition_t *part)
+{
+    if (part == NULL)
+        return;
+    for (int i = 0; i < part->totalRects; i++)
+        free(part->rects[i]);
+    free(part->rects);
+    free(part->tiles);
+    free(part);
+}
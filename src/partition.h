@@ -0,0 +1,110 @@
+/** \file partition.h
+    \author Giorgio Vinciguerra
+    \date Giugno 2015
+    \copyright Copyright (c) 2015 Giorgio Vinciguerra. All rights reserved.
+    \note  Si dichiara che il contenuto di questo file è in ogni sua parte opera
+           originale dell' autore.
+    \brief File contenente i prototipi delle funzioni per la suddivisione del
+           pianeta in rettangoli aggiornabili in parallelo.
+*/
+
+#ifndef __PARTITION__H
+#define __PARTITION__H
+
+#include "wator.h"
+
+/** Distanza minima, in celle, tra due rettangoli dello stesso batch. Una
+    creatura può spostarsi in una cella adiacente e far nascere un figlio in
+    una cella adiacente alla nuova posizione: aggiornando un rettangolo si
+    leggono e scrivono celle fino a due posizioni fuori dai suoi bordi. */
+#define PARTITION_GAP 4
+
+/** Lato di default, in celle, di un riquadro. Un riquadro di 128x128 celle
+    occupa circa 200KB tra celle, contatori e timbri: sta nella cache L2. */
+#define PARTITION_TILE_SIDE 128
+
+/** Costo di una cella con un pesce o uno squalo, relativo a quello di una
+    cella d'acqua, usato da rebalance_partition */
+#define PARTITION_ANIMAL_COST 8
+
+/** Numero massimo di batch in cui è suddiviso il lavoro di un chronon: i
+    riquadri sono colorati come una scacchiera 2x2 */
+#define PARTITION_MAX_BATCHES 4
+
+/** Una suddivisione del pianeta in batch di rettangoli. I rettangoli di uno
+    stesso batch sono a distanza di almeno PARTITION_GAP celle l'uno
+    dall'altro (anche attraverso i bordi del pianeta), quindi possono essere
+    aggiornati in parallelo; i batch vanno invece eseguiti uno dopo l'altro,
+    nell'ordine.
+ */
+typedef struct partition {
+    /** n° di batch */
+    int numBatches;
+    /** n° di rettangoli di ciascun batch */
+    int batchSize[PARTITION_MAX_BATCHES];
+    /** batch[b][i] è l'i-esimo rettangolo del batch b */
+    rect_t **batch[PARTITION_MAX_BATCHES];
+    /** n° totale di rettangoli */
+    int totalRects;
+    /** tutti i rettangoli, ordinati per batch */
+    rect_t **rects;
+    /** n° di riquadri lungo le righe e lungo le colonne del pianeta */
+    int tilesY, tilesX;
+    /** i riquadri per righe: tiles[i * tilesX + j] è il riquadro (i,j) */
+    rect_t **tiles;
+} partition_t;
+
+/** Suddivide un pianeta in una griglia di riquadri di circa tileRows x
+    tileCols celle. I riquadri sono colorati come una scacchiera 2x2 e ogni
+    colore forma un batch: due riquadri dello stesso colore sono sempre
+    separati da un riquadro di un altro colore. Per questo il numero di
+    riquadri su una dimensione è pari (oppure 1, se il pianeta è troppo
+    piccolo per due riquadri) e ogni riquadro ha lato almeno PARTITION_GAP.
+    \param nrow n° di righe del pianeta
+    \param ncol n° di colonne del pianeta
+    \param tileRows altezza desiderata dei riquadri
+    \param tileCols larghezza desiderata dei riquadri
+    \return la suddivisione, oppure NULL (errno viene settato) in caso di errore
+ */
+partition_t *new_partition(int nrow, int ncol, int tileRows, int tileCols);
+
+/** Sposta i confini tra i riquadri di una suddivisione, così che ogni fascia
+    di riquadri (orizzontale o verticale) contenga circa lo stesso lavoro: una
+    cella costa 1, una cella con un pesce o uno squalo PARTITION_ANIMAL_COST.
+    Il numero di riquadri, il loro batch e gli indirizzi dei rettangoli non
+    cambiano, e ogni riquadro resta alto e largo almeno PARTITION_GAP.
+    Va chiamata quando nessun thread sta aggiornando il pianeta.
+    \param part la suddivisione
+    \param p il pianeta suddiviso da part
+    \return 0 se tutto e' andato bene
+    \return -1 se si e' verificato un errore (setta errno)
+ */
+int rebalance_partition(partition_t *part, planet_t *p);
+
+/** Sceglie il lato dei riquadri per un pianeta e un numero di worker: parte da
+    PARTITION_TILE_SIDE e lo dimezza finché ogni batch non ha almeno un
+    riquadro per worker (o il lato non scende a PARTITION_GAP).
+    \param nrow n° di righe del pianeta
+    \param ncol n° di colonne del pianeta
+    \param workers n° di worker che aggiorneranno il pianeta
+    \return il lato dei riquadri
+ */
+int partition_tile_side(int nrow, int ncol, int workers);
+
+/** Restituisce il batch (il colore) del riquadro (i,j) di una suddivisione
+    \param part la suddivisione
+    \param (i,j) la posizione del riquadro nella griglia
+ */
+int tile_batch(partition_t *part, int i, int j);
+
+/** Restituisce il n° di rettangoli del batch più grande di una suddivisione
+    \param part la suddivisione
+ */
+int partition_max_batch_size(partition_t *part);
+
+/** Libera la memoria occupata da una suddivisione
+    \param part la suddivisione da liberare
+ */
+void free_partition(partition_t *part);
+
+#endif
@@ -0,0 +1,80 @@
+/** \file phases.c
+    \author Giorgio Vinciguerra
+    \date Giugno 2015
+    \copyright Copyright (c) 2015 Giorgio Vinciguerra. All rights reserved.
+    \note  Si dichiara che il contenuto di questo file è in ogni sua parte opera
+           originale dell' autore.
+    \brief File contenente l'implementazione della misura dei tempi delle fasi
+           di un chronon.
+*/
+
+#include "phases.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Il contatore dei thread senza contatore proprio: i suoi tempi non vengono stampati */
+static phase_counters_t unusedPhases;
+
+__thread phase_counters_t *threadPhases = &unusedPhases;
+
+static phase_counters_t *phases; // un contatore per thread
+static int totalSlots;
+
+/* I tempi dei contatori liberati da teardown_phases, che restano nei totali */
+static unsigned long long retired[PHASE_COUNT];
+
+/* I nomi delle fasi, stampati da print_phases */
+static const char *phaseNames[PHASE_BATCH] = {
+    "update", "dequeue", "lock", "wait", "delay", "send", "rebalance"
+};
+
+void setup_phases(int threads)
+{
+    if (0 != posix_memalign((void **) &phases, PLANET_ALIGNMENT, threads * sizeof(phase_counters_t)))
+        print_fatal_error("Impossibile allocare i contatori dei tempi");
+    memset(phases, 0, threads * sizeof(phase_counters_t));
+    totalSlots = threads;
+}
+
+void teardown_phases()
+{
+    for (int ph = 0; ph < PHASE_COUNT; ph++)
+        for (int s = 0; s < totalSlots; s++)
+            retired[ph] += phases[s].ns[ph];
+    free(phases);
+    phases = NULL;
+    totalSlots = 0;
+}
+
+void phase_thread(int slot)
+{
+    threadPhases = &phases[slot];
+}
+
+unsigned long long phase_total(phase_t ph)
+{
+    unsigned long long total = retired[ph];
+    for (int s = 0; s < totalSlots; s++)
+        total += __atomic_load_n(&phases[s].ns[ph], __ATOMIC_RELAXED);
+    return total;
+}
+
+void phase_name(phase_t ph, char name[16])
+{
+    if (ph < PHASE_BATCH)
+        strcpy(name, phaseNames[ph]);
+    else
+        sprintf(name, "batch%d", ph - PHASE_BATCH);
+}
+
+void print_phases(FILE *f, long chronons)
+{
+    for (int ph = 0; ph < PHASE_COUNT; ph++) {
+        unsigned long long total = phase_total(ph);
+        char name[16];
+        phase_name(ph, name);
+        fprintf(f, "Fase %-10s %12.3f ms, %10.3f us/chronon\n", name, total / 1e6,
+                chronons > 0 ? total / 1e3 / chronons : 0);
+    }
+}
@@ -0,0 +1,108 @@
+/** \file phases.h
+    \author Giorgio Vinciguerra
+    \date Giugno 2015
+    \copyright Copyright (c) 2015 Giorgio Vinciguerra. All rights reserved.
+    \note  Si dichiara che il contenuto di questo file è in ogni sua parte opera
+           originale dell' autore.
+    \brief File contenente i prototipi delle funzioni che misurano il tempo
+           speso dai thread della simulazione in ciascuna fase di un chronon.
+
+    Ogni thread accumula i propri tempi in un contatore privato, che occupa
+    linee di cache separate da quelle degli altri thread: la misura di una
+    fase costa solo una lettura dell'orologio e una somma, senza alcuna
+    sincronizzazione. I contatori vengono sommati da print_phases, a
+    simulazione terminata, e da phase_total, che il comando metrics del
+    socket di controllo chiama mentre i worker li aggiornano: queste letture
+    non sono sincronizzate e danno solo valori approssimati.
+*/
+
+#ifndef __PHASES__H
+#define __PHASES__H
+
+#include "partition.h"
+#include <time.h>
+#include <stdio.h>
+
+/** Le fasi misurate:
+    PHASE_UPDATE aggiornamento dei rettangoli (update_wator_rect)
+    PHASE_DEQUEUE attesa di un task sulla coda della farm (dequeue)
+    PHASE_LOCK attesa per l'acquisizione del mutex sullo stato della farm
+    PHASE_WAIT attesa sulle barriere o dei riquadri vicini (pool e wave)
+    PHASE_DELAY attesa della scadenza del chronon, se chronDelay > 0
+    PHASE_SEND consegna del pianeta all'esportatore (vedi export.h)
+    PHASE_REBALANCE ribilanciamento della suddivisione del pianeta
+    PHASE_BATCH + b durata del batch b, dall'inizio all'ultimo task completato
+    (farm e pool) */
+typedef enum {
+    PHASE_UPDATE, PHASE_DEQUEUE, PHASE_LOCK, PHASE_WAIT, PHASE_DELAY,
+    PHASE_SEND, PHASE_REBALANCE, PHASE_BATCH,
+    PHASE_COUNT = PHASE_BATCH + PARTITION_MAX_BATCHES
+} phase_t;
+
+/** I tempi, in nanosecondi, accumulati da un thread in ciascuna fase. La
+    dimensione è arrotondata a un multiplo di PLANET_ALIGNMENT, così che i
+    contatori di due thread non condividano una linea di cache */
+typedef union {
+    unsigned long long ns[PHASE_COUNT];
+    char padding[(PHASE_COUNT * sizeof(unsigned long long) + PLANET_ALIGNMENT - 1)
+                 / PLANET_ALIGNMENT * PLANET_ALIGNMENT];
+} phase_counters_t;
+
+/** Il contatore del thread corrente (vedi phase_thread) */
+extern __thread phase_counters_t *threadPhases;
+
+/** Alloca i contatori di threads thread. Va chiamata prima di creare i
+    thread. */
+void setup_phases(int threads);
+
+/** Libera la memoria allocata da setup_phases, quando i thread sono
+    terminati. I tempi accumulati continuano a far parte dei totali, anche
+    dopo una nuova chiamata a setup_phases. */
+void teardown_phases();
+
+/** Assegna al thread corrente il contatore slot (in [0, threads)). I tempi dei
+    thread senza contatore non vengono conteggiati. */
+void phase_thread(int slot);
+
+/** Restituisce l'istante corrente, in nanosecondi, dell'orologio monotono */
+static inline unsigned long long phase_now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+/** Conteggia nella fase ph del thread corrente il tempo trascorso da since.
+    \param ph la fase
+    \param since l'istante di inizio della fase (restituito da phase_now)
+    \return l'istante corrente, che può fare da inizio della fase successiva
+ */
+static inline unsigned long long phase_add(phase_t ph, unsigned long long since)
+{
+    unsigned long long now = phase_now();
+    threadPhases->ns[ph] += now - since;
+    return now;
+}
+
+/** Restituisce il tempo, in nanosecondi, speso finora nella fase ph da tutti
+    i thread. Può essere chiamata durante la simulazione: il risultato è
+    approssimato perché i thread continuano ad aggiornare i contatori.
+    \param ph la fase
+ */
+unsigned long long phase_total(phase_t ph);
+
+/** Scrive in name il nome della fase ph (ad esempio "update" o "batch2")
+    \param ph la fase
+    \param name il buffer di destinazione
+ */
+void phase_name(phase_t ph, char name[16]);
+
+/** Stampa su f il tempo totale speso in ciascuna fase da tutti i thread
+    (compresi i contatori già liberati) e la media per chronon, una fase per
+    riga e sempre nello stesso ordine.
+    \param f il file su cui stampare
+    \param chronons il n° di chronon simulati
+ */
+void print_phases(FILE *f, long chronons);
+
+#endif
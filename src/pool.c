@@ -0,0 +1,144 @@
+/** \file pool.c
+    \author Giorgio Vinciguerra
+    \date Giugno 2015
+    \copyright Copyright (c) 2015 Giorgio Vinciguerra. All rights reserved.
+    \note  Si dichiara che il contenuto di questo file è in ogni sua parte opera
+           originale dell' autore.
+    \brief File contenente l'implementazione del motore di esecuzione a pool.
+*/
+
+#include "pool.h"
+#include "barrier.h"
+#include "steal.h"
+#include "phases.h"
+#include "trace.h"
+#include "control.h"
+#include "utils.h"
+#include <stdlib.h>
+
+/* La barriera su cui si sincronizzano i worker alla fine di ogni batch */
+static barrier_t poolBarrier;
+
+/* Le code dei worker: contengono indici dei rettangoli del batch corrente */
+static task_deque_t *poolDeques;
+
+/* Diventa true alla fine dell'ultimo chronon della simulazione */
+static volatile bool poolTerminating = false;
+
+/* I task rubati dai worker dei pool già liberati da teardown_pool */
+static unsigned long retiredSteals = 0;
+
+/* L'istante in cui i rettangoli del batch corrente sono stati distribuiti */
+static unsigned long long batchStart;
+
+/* Distribuisce i rettangoli del batch b: il worker w riceve il w-esimo blocco
+   contiguo, così che aggiorni rettangoli vicini tra loro */
+static void deal_batch(int b)
+{
+    long size = planetPartition->batchSize[b];
+    for (int w = 0; w < totalWorkers; w++)
+        deque_fill(&poolDeques[w], w * size / totalWorkers, (w + 1) * size / totalWorkers);
+    batchStart = phase_now();
+}
+
+/* Eseguita dall'ultimo worker arrivato sulla barriera di fine batch. arg punta
+   al n° del batch successivo */
+static void end_of_batch(void *arg)
+{
+    int b = *(int *) arg - 1;
+    trace_event(TRACE_BATCH, batchStart, phase_add(PHASE_BATCH + b, batchStart), NULL, b, wator->chronon);
+    deal_batch(*(int *) arg);
+}
+
+/* Eseguita dall'ultimo worker arrivato sulla barriera di fine chronon */
+static void end_of_chronon(void *arg)
+{
+    int b = *(int *) arg - 1;
+    trace_event(TRACE_BATCH, batchStart, phase_add(PHASE_BATCH + b, batchStart), NULL, b, wator->chronon);
+    complete_chronon();
+    control_chronon_done(); // Se la simulazione è in pausa attende il comando che la riprende
+    if (mustTerminateFlag || mustStopEngine)
+        poolTerminating = true;
+    deal_batch(0);
+}
+
+/* Aggiorna il rettangolo rect del batch b e, se richiesto, ne registra la durata */
+static inline void run_task(rect_t *rect, int b, wator_delta_t *delta)
+{
+    if (!traceEnabled)
+        update_wator_rect((wator_t *) wator, rect, delta);
+    else {
+        unsigned long long start = phase_now();
+        update_wator_rect((wator_t *) wator, rect, delta);
+        trace_event(TRACE_TASK, start, phase_now(), rect, b, wator->chronon);
+    }
+}
+
+void setup_pool()
+{
+    poolTerminating = false;
+    barrier_init(&poolBarrier, totalWorkers);
+    if (0 != posix_memalign((void **) &poolDeques, STEAL_CACHE_LINE, totalWorkers * sizeof(task_deque_t)))
+        print_fatal_error("Errore nel setup del pool");
+    for (int w = 0; w < totalWorkers; w++)
+        poolDeques[w].steals = 0;
+    deal_batch(0);
+}
+
+void teardown_pool()
+{
+    for (int w = 0; w < totalWorkers; w++)
+        retiredSteals += poolDeques[w].steals;
+    free(poolDeques);
+}
+
+void print_pool_steals(FILE *f)
+{
+    unsigned long total = retiredSteals;
+    for (int w = 0; w < totalWorkers; w++)
+        total += poolDeques[w].steals;
+    fprintf(f, "Task rubati dai worker: %lu (", total);
+    for (int w = 0; w < totalWorkers; w++)
+        fprintf(f, w == 0 ? "%lu" : " %lu", poolDeques[w].steals);
+    fprintf(f, ")\n");
+}
+
+void *pool_worker_loop(void *arg)
+{
+    int workerNumber = *(int *)arg;
+    create_worker_file(workerNumber);
+    free(arg);
+    phase_thread(workerNumber);
+    trace_thread(workerNumber);
+
+    wator_delta_t *delta = &workerDeltas[workerNumber].delta;
+    task_deque_t *ownDeque = &poolDeques[workerNumber];
+    int lastBatch = planetPartition->numBatches - 1;
+    unsigned int i;
+
+    while (!poolTerminating) {
+        for (int b = 0; b <= lastBatch; b++) {
+            rect_t **rects = planetPartition->batch[b];
+            unsigned long long start = phase_now();
+            while (deque_pop(ownDeque, &i))
+                run_task(rects[i], b, delta);
+
+            // La propria coda è vuota: ruba dalle altre, a partire da quella del worker successivo
+            for (int v = 1; v < totalWorkers; v++) {
+                task_deque_t *victim = &poolDeques[(workerNumber + v) % totalWorkers];
+                while (deque_steal(victim, &i)) {
+                    run_task(rects[i], b, delta);
+                    ownDeque->steals++;
+                }
+            }
+
+            start = phase_add(PHASE_UPDATE, start);
+            int nextBatch = b + 1;
+            bool completed = barrier_wait(&poolBarrier, b == lastBatch ? end_of_chronon : end_of_batch, &nextBatch);
+            if (!completed) // Il tempo di chi ha eseguito la fine del batch è già conteggiato nelle sue fasi
+                phase_add(PHASE_WAIT, start);
+        }
+    }
+
+    return NULL;
+}
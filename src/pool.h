@@ -0,0 +1,40 @@
+/** \file pool.h
+    \author Giorgio Vinciguerra
+    \date Giugno 2015
+    \copyright Copyright (c) 2015 Giorgio Vinciguerra. All rights reserved.
+    \note  Si dichiara che il contenuto di questo file è in ogni sua parte opera
+           originale dell' autore.
+    \brief File contenente i prototipi delle funzioni del motore di esecuzione
+           a pool, alternativo alla struttura a farm.
+
+    Nel motore a pool non ci sono né dispatcher né collector: ogni worker
+    riceve un blocco contiguo dei rettangoli di ciascun batch nella propria
+    coda (vedi steal.h) e, quando l'ha svuotata, ruba i rettangoli rimasti
+    nelle code degli altri worker. I worker si sincronizzano tra un batch e
+    l'altro con una barriera. L'ultimo worker che arriva sulla barriera di
+    fine chronon esegue complete_chronon.
+*/
+
+#ifndef __POOL__H
+#define __POOL__H
+
+#include "farm.h"
+
+/** Prepara la barriera e le code dei worker del pool. Va chiamata dopo
+    setup_farm e prima di creare i thread worker, anche quando il motore
+    viene riavviato. */
+void setup_pool();
+
+/** Libera la memoria allocata da setup_pool. */
+void teardown_pool();
+
+/** Stampa su f il numero totale di task rubati, compresi quelli dei pool già
+    liberati, e quelli rubati da ciascun worker del pool corrente.
+    \param f il file su cui stampare
+ */
+void print_pool_steals(FILE *f);
+
+/** Il ciclo eseguito da uno dei thread worker del pool. */
+void *pool_worker_loop(void *arg);
+
+#endif
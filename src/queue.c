@@ -7,83 +7,168 @@
     \brief File contenente l'implementazione di funzioni per la creazione e la
            gestione di una semplice coda concorrente.
 */
+/*
+ INFO PER LA COMPRENSIONE DELL'ALGORITMO
+ Ogni posizione i del buffer ha un numero di sequenza. Inizialmente vale i:
+ la posizione è libera per il produttore che otterrà il ticket enqueuePos=i.
+ Il produttore, dopo aver scritto l'elemento, lo porta a i+1: la posizione è
+ piena per il consumatore con il ticket dequeuePos=i. Il consumatore, dopo
+ aver letto l'elemento, lo porta a i+capacità: la posizione è di nuovo libera
+ per il produttore del "giro" successivo del buffer. I ticket si prendono con
+ una compare-and-swap, quindi non servono lock né allocazioni per elemento.
+
+ Un consumatore che trova la coda vuota per QUEUE_SPIN volte incrementa
+ sleepers e si mette in attesa sulla variabile di condizione. Un produttore
+ acquisisce il mutex per risvegliarlo solo se sleepers è maggiore di zero.
+ */
 
 #include "queue.h"
-#include <limits.h>
+#include "utils.h"
+#include <sched.h>
 #include <stdlib.h>
 
-void enqueue(volatile queue_t *q, void *info)
+/* Prova a inserire info nella coda. Ritorna false se la coda è piena. */
+static bool try_enqueue(queue_t *q, void *info)
 {
-    if (q == NULL || info == NULL || q->size == INT_MIN)
-        return;
-    pthread_mutex_lock((pthread_mutex_t*) &q->mutex);
+    unsigned long pos = __atomic_load_n(&q->enqueuePos, __ATOMIC_RELAXED);
+    while (true) {
+        queue_slot_t *slot = &q->slots[pos & q->mask];
+        unsigned long seq = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        long diff = (long) seq - (long) pos;
+        if (diff == 0) { // Posizione libera: prova a prendere il ticket
+            if (__atomic_compare_exchange_n(&q->enqueuePos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                slot->info = info;
+                __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+        }
+        else if (diff < 0) // Il consumatore del giro precedente non l'ha ancora liberata
+            return false;
+        else
+            pos = __atomic_load_n(&q->enqueuePos, __ATOMIC_RELAXED);
+    }
+}
+
+/* Prova a estrarre un elemento dalla coda. Ritorna false se la coda è vuota. */
+static bool try_dequeue(queue_t *q, void **info)
+{
+    unsigned long pos = __atomic_load_n(&q->dequeuePos, __ATOMIC_RELAXED);
+    while (true) {
+        queue_slot_t *slot = &q->slots[pos & q->mask];
+        unsigned long seq = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        long diff = (long) seq - (long) (pos + 1);
+        if (diff == 0) { // Posizione piena: prova a prendere il ticket
+            if (__atomic_compare_exchange_n(&q->dequeuePos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *info = slot->info;
+                __atomic_store_n(&slot->sequence, pos + q->mask + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+        }
+        else if (diff < 0) // Nessun produttore ha ancora riempito la posizione
+            return false;
+        else
+            pos = __atomic_load_n(&q->dequeuePos, __ATOMIC_RELAXED);
+    }
+}
+
+/* true se la posizione in testa alla coda non contiene ancora un elemento */
+static bool is_empty(queue_t *q)
+{
+    unsigned long pos = __atomic_load_n(&q->dequeuePos, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&q->slots[pos & q->mask].sequence, __ATOMIC_SEQ_CST) != pos + 1;
+}
 
-    queue_element_t *newRear = malloc(sizeof(queue_element_t));
-    if (newRear == NULL) {
-        pthread_mutex_unlock((pthread_mutex_t*) &q->mutex);
+void enqueue(volatile queue_t *vq, void *info)
+{
+    queue_t *q = (queue_t *) vq;
+    if (q == NULL || info == NULL)
         return;
+
+    while (!__atomic_load_n(&q->destroyed, __ATOMIC_ACQUIRE) && !try_enqueue(q, info))
+        sched_yield(); // Coda piena: lascia lavorare i consumatori
+
+    // Risveglia un consumatore solo se qualcuno si è messo in attesa
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&q->sleepers, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&q->mutex);
+        pthread_cond_signal(&q->cond);
+        pthread_mutex_unlock(&q->mutex);
     }
-    newRear->info = info;
-    newRear->next = NULL;
-    if (q->rear != NULL)
-        q->rear->next = newRear;
-    q->rear = newRear;
-    q->size++;
-    if (q->front == NULL)
-        q->front = newRear;
-
-    pthread_cond_signal((pthread_cond_t*) &q->cond);
-    pthread_mutex_unlock((pthread_mutex_t*) &q->mutex);
 }
 
-void *dequeue(volatile queue_t *q)
+void *dequeue(volatile queue_t *vq)
 {
-    if (q == NULL || q->size == INT_MIN)
+    queue_t *q = (queue_t *) vq;
+    if (q == NULL)
         return NULL;
-    pthread_mutex_lock((pthread_mutex_t*) &q->mutex);
 
-    while (q->front == NULL && q->size != INT_MIN) // Se la coda non è vuota e non distrutta
-        pthread_cond_wait((pthread_cond_t*) &q->cond, (pthread_mutex_t*) &q->mutex);
-    if (q->size == INT_MIN) {
-        pthread_mutex_unlock((pthread_mutex_t *) &q->mutex);
-        return NULL;
-    }
+    void *dequeuedInfo;
+    while (true) {
+        for (int i = 0; i < QUEUE_SPIN; i++) {
+            if (__atomic_load_n(&q->destroyed, __ATOMIC_ACQUIRE))
+                return NULL;
+            if (try_dequeue(q, &dequeuedInfo))
+                return dequeuedInfo;
+            CPU_RELAX();
+        }
 
-    void *dequeuedInfo = q->front->info;
-    queue_element_t *tmp = q->front;
-    if (q->front == q->rear) // Coda di un solo elemento
-        q->rear = NULL;
-    q->front = q->front->next;
-    q->size--;
+        pthread_mutex_lock(&q->mutex);
+        __atomic_add_fetch(&q->sleepers, 1, __ATOMIC_SEQ_CST);
+        while (is_empty(q) && !__atomic_load_n(&q->destroyed, __ATOMIC_SEQ_CST))
+            pthread_cond_wait(&q->cond, &q->mutex);
+        __atomic_sub_fetch(&q->sleepers, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&q->mutex);
+    }
+}
 
-    free(tmp);
-    pthread_mutex_unlock((pthread_mutex_t*) &q->mutex);
-    return dequeuedInfo;
+unsigned long queue_length(volatile queue_t *vq)
+{
+    queue_t *q = (queue_t *) vq;
+    unsigned long dequeued = __atomic_load_n(&q->dequeuePos, __ATOMIC_ACQUIRE);
+    unsigned long enqueued = __atomic_load_n(&q->enqueuePos, __ATOMIC_ACQUIRE);
+    return enqueued > dequeued ? enqueued - dequeued : 0;
 }
 
-queue_t *create_queue()
+queue_t *create_queue(unsigned int capacity)
 {
+    unsigned long slots = 2;
+    while (slots < capacity)
+        slots *= 2;
+
     queue_t *q = calloc(1, sizeof(queue_t));
-    if (q != NULL && (-1 == pthread_mutex_init(&q->mutex, NULL)
-                  ||  -1 == pthread_cond_init(&q->cond, NULL))) {
+    if (q == NULL)
+        return NULL;
+    q->slots = malloc(slots * sizeof(queue_slot_t));
+    if (q->slots == NULL || 0 != pthread_mutex_init(&q->mutex, NULL)
+                         || 0 != pthread_cond_init(&q->cond, NULL)) {
+        free(q->slots);
         free(q);
         return NULL;
     }
+
+    q->mask = slots - 1;
+    for (unsigned long i = 0; i < slots; i++)
+        q->slots[i].sequence = i;
     return q;
 }
 
-void destroy_queue(volatile queue_t *q)
+void destroy_queue(volatile queue_t *vq)
 {
-    pthread_mutex_lock((pthread_mutex_t *) &q->mutex);
-    
-    while (q->front != NULL) {
-        queue_element_t *tmp = q->front;
-        q->front = q->front->next;
-        free(tmp);
-    }
-    q->rear = NULL;
-    q->size = INT_MIN;
+    queue_t *q = (queue_t *) vq;
+    pthread_mutex_lock(&q->mutex);
+
+    // Gli elementi rimasti vengono abbandonati: enqueue e dequeue non li vedranno più
+    __atomic_store_n(&q->destroyed, true, __ATOMIC_SEQ_CST);
 
-    pthread_cond_broadcast((pthread_cond_t*) &q->cond);
-    pthread_mutex_unlock((pthread_mutex_t*) &q->mutex);
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+void free_queue(volatile queue_t *vq)
+{
+    queue_t *q = (queue_t *) vq;
+    pthread_mutex_destroy(&q->mutex);
+    pthread_cond_destroy(&q->cond);
+    free(q->slots);
+    free(q);
 }
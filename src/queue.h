@@ -14,30 +14,48 @@
 #include <pthread.h>
 #include <stdbool.h>
 
-/** Tipo di un generico elemento della coda. */
-typedef struct queue_element {
+/** Dimensione di una linea di cache, usata per separare i campi della coda
+    scritti da thread diversi */
+#define QUEUE_CACHE_LINE 64
+
+/** Numero di tentativi che dequeue esegue su una coda vuota prima di
+    mettersi in attesa sulla variabile di condizione */
+#define QUEUE_SPIN 256
+
+/** Tipo di una posizione del buffer circolare della coda. */
+typedef struct queue_slot {
+    unsigned long sequence; // Indica se la posizione è libera o contiene un elemento
     void *info;
-    struct queue_element *next;
-} queue_element_t;
+} queue_slot_t;
 
-/** Tipo di una coda */
+/** Tipo di una coda: un buffer circolare di capacità fissa, senza lock, con
+    più produttori e più consumatori (l'algoritmo è quello di D. Vyukov).
+    Mutex e variabile di condizione servono solo a "parcheggiare" i
+    consumatori quando la coda resta vuota. */
 typedef struct queue {
-    int size;
+    queue_slot_t *slots;
+    unsigned long mask;     // capacità - 1 (la capacità è una potenza di 2)
+    char padding1[QUEUE_CACHE_LINE];
+    unsigned long enqueuePos;
+    char padding2[QUEUE_CACHE_LINE];
+    unsigned long dequeuePos;
+    char padding3[QUEUE_CACHE_LINE];
+    bool destroyed;
+    int sleepers;           // n° di consumatori in attesa sulla variabile di condizione
     pthread_mutex_t mutex;
     pthread_cond_t  cond;
-    queue_element_t *front;
-    queue_element_t *rear;
 } queue_t;
 
 
 /** Aggiunge un elemento in fondo alla coda. Se la coda è stata distrutta non
-    fa nulla.
+    fa nulla. Se la coda è piena attende che un consumatore liberi un posto.
     \param q la coda
     \param info puntatore non nullo all'elemento da aggiungere
  */
 void enqueue(volatile queue_t *q, void *info);
 
-/** Estrae l'elemento in testa alla coda. Se la coda è vuota si mette in attesa.
+/** Estrae l'elemento in testa alla coda. Se la coda è vuota riprova per
+    QUEUE_SPIN volte e poi si mette in attesa.
     Se la coda è stata distrutta restituisce un puntatore nullo.
     \param q la coda
     \return il puntatore all'elemento estratto
@@ -45,11 +63,19 @@ void enqueue(volatile queue_t *q, void *info);
  */
 void *dequeue(volatile queue_t *q);
 
+/** Restituisce il numero di elementi nella coda. Il valore è approssimato se
+    altri thread stanno inserendo o estraendo elementi.
+    \param q la coda
+ */
+unsigned long queue_length(volatile queue_t *q);
+
 /** Crea una nuova coda vuota.
+    \param capacity il numero massimo di elementi nella coda (viene arrotondato
+           alla potenza di 2 successiva)
     \return Il puntatore alla nuova coda, oppure NULL se c'è stato un problema
             nell'allocazione.
  */
-queue_t *create_queue();
+queue_t *create_queue(unsigned int capacity);
 
 /** Distrugge la coda, eliminando tutti gli item. Se qualche thread è in attesa
     su dequeue, questa restituirà NULL. Le chiamate successive a enqueue sulla
@@ -58,4 +84,10 @@ queue_t *create_queue();
  */
 void destroy_queue(volatile queue_t *q);
 
+/** Libera la memoria della coda. Va chiamata dopo destroy_queue, quando
+    nessun thread usa più la coda.
+    \param q la coda
+ */
+void free_queue(volatile queue_t *q);
+
 #endif
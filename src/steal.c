@@ -0,0 +1,54 @@
+/** \file steal.c
+    \author Giorgio Vinciguerra
+    \date Giugno 2015
+    \copyright Copyright (c) 2015 Giorgio Vinciguerra. All rights reserved.
+    \note  Si dichiara che il contenuto di questo file è in ogni sua parte opera
+           originale dell' autore.
+    \brief File contenente l'implementazione delle code di task private dei
+           worker, dalle quali gli altri worker possono rubare.
+*/
+/*
+ INFO PER LA COMPRENSIONE DELL'ALGORITMO
+ Una coda viene riempita solo tra un batch e l'altro, quando nessuno la usa.
+ Durante il batch gli indici possono solo uscire: il proprietario incrementa
+ head, un ladro decrementa tail. Entrambi gli estremi stanno in una parola a
+ 64 bit e vengono modificati con una compare-and-swap, quindi un indice è
+ estratto da un solo thread anche quando proprietario e ladro si contendono
+ l'ultimo elemento. Il proprietario procede dalla testa, così aggiorna
+ rettangoli vicini tra loro; il ladro prende quelli più lontani.
+ */
+
+#include "steal.h"
+
+#define HEAD(ends) ((unsigned int) ((ends) >> 32))
+#define TAIL(ends) ((unsigned int) (ends))
+#define ENDS(head, tail) ((unsigned long long) (head) << 32 | (tail))
+
+void deque_fill(task_deque_t *d, unsigned int from, unsigned int to)
+{
+    __atomic_store_n(&d->ends, ENDS(from, to), __ATOMIC_RELEASE);
+}
+
+bool deque_pop(task_deque_t *d, unsigned int *index)
+{
+    unsigned long long ends = __atomic_load_n(&d->ends, __ATOMIC_ACQUIRE);
+    while (HEAD(ends) < TAIL(ends))
+        if (__atomic_compare_exchange_n(&d->ends, &ends, ENDS(HEAD(ends) + 1, TAIL(ends)), false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            *index = HEAD(ends);
+            return true;
+        }
+    return false;
+}
+
+bool deque_steal(task_deque_t *d, unsigned int *index)
+{
+    unsigned long long ends = __atomic_load_n(&d->ends, __ATOMIC_ACQUIRE);
+    while (HEAD(ends) < TAIL(ends))
+        if (__atomic_compare_exchange_n(&d->ends, &ends, ENDS(HEAD(ends), TAIL(ends) - 1), false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            *index = TAIL(ends) - 1;
+            return true;
+        }
+    return false;
+}
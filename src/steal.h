@@ -0,0 +1,56 @@
+/** \file steal.h
+    \author Giorgio Vinciguerra
+    \date Giugno 2015
+    \copyright Copyright (c) 2015 Giorgio Vinciguerra. All rights reserved.
+    \note  Si dichiara che il contenuto di questo file è in ogni sua parte opera
+           originale dell' autore.
+    \brief File contenente i prototipi di funzioni per le code di task
+           private dei worker, dalle quali gli altri worker possono rubare.
+*/
+
+#ifndef __STEAL__H
+#define __STEAL__H
+
+#include <stdbool.h>
+
+/** Dimensione di una linea di cache, usata per separare le code di worker
+    diversi */
+#define STEAL_CACHE_LINE 64
+
+/** Tipo di una coda di task di un worker. La coda non contiene i task ma un
+    intervallo [head, tail) di indici in un vettore di task condiviso (per
+    esempio un batch della suddivisione del pianeta). Il proprietario estrae
+    gli indici dalla testa, gli altri worker li rubano dalla coda: gli estremi
+    stanno in un'unica parola, modificata con una compare-and-swap.
+ */
+typedef struct task_deque {
+    unsigned long long ends;  // head nei 32 bit alti, tail nei 32 bit bassi
+    char padding1[STEAL_CACHE_LINE - sizeof(unsigned long long)];
+    unsigned long steals;     // n° di task rubati dal proprietario ad altre code
+    char padding2[STEAL_CACHE_LINE - sizeof(unsigned long)];
+} task_deque_t;
+
+/** Assegna alla coda gli indici [from, to). Va chiamata quando nessun altro
+    thread sta usando la coda.
+    \param d la coda
+    \param from il primo indice
+    \param to l'indice successivo all'ultimo
+ */
+void deque_fill(task_deque_t *d, unsigned int from, unsigned int to);
+
+/** Estrae l'indice in testa alla coda. È usata dal proprietario della coda.
+    \param d la coda
+    \param index l'indice estratto (modificato in uscita)
+    \return false se la coda è vuota
+ */
+bool deque_pop(task_deque_t *d, unsigned int *index);
+
+/** Ruba l'indice in fondo alla coda. È usata dai worker che hanno svuotato la
+    propria coda.
+    \param d la coda da cui rubare
+    \param index l'indice rubato (modificato in uscita)
+    \return false se la coda è vuota
+ */
+bool deque_steal(task_deque_t *d, unsigned int *index);
+
+#endif
@@ -0,0 +1,230 @@
+/** \file   bench_wator.c
+    \author Giorgio Vinciguerra
+    \date   Giugno 2015
+    \copyright Copyright (c) 2015 Giorgio Vinciguerra. All rights reserved.
+    \note   Si dichiara che il contenuto di questo file è in ogni sua parte opera
+            originale dell' autore.
+    \brief  Microbenchmark delle regole e delle funzioni di aggiornamento della
+            libreria wator.
+
+    Per ogni combinazione di dimensione del pianeta, densità della popolazione
+    e disposizione in memoria (con o senza bordo fantasma) genera un pianeta
+    casuale e misura shark_rule1, shark_rule2, fish_rule3, fish_rule4,
+    neighbor_cell, update_wator e update_wator_rect. Ogni misura è preceduta da
+    BENCH_WARMUP ripetizioni non cronometrate e ripetuta BENCH_REPS volte sullo
+    stesso pianeta di partenza. Il risultato è stampato sullo stdout in formato
+    CSV: una riga per misura con media e deviazione standard dei nanosecondi
+    per cella elaborata.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "wator.h"
+#include <math.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/** Numero di ripetizioni non cronometrate che precedono ogni misura */
+#define BENCH_WARMUP 3
+
+/** Numero di ripetizioni cronometrate di ogni misura */
+#define BENCH_REPS 15
+
+/** Seme dei pianeti generati e delle regole */
+#define BENCH_SEED 42UL
+
+/** Lati dei pianeti (quadrati) misurati */
+static const int sizes[] = {64, 256, 1024};
+
+/** Densità misurate: percentuale di squali e di pesci sul totale delle celle */
+static const struct { const char *name; int sharks, fish; } densities[] = {
+    {"sparse", 5, 15},
+    {"medium", 15, 35},
+    {"dense", 30, 60},
+};
+
+/** Una funzione misurata: elabora il pianeta di w e restituisce il numero di
+    celle elaborate */
+typedef long (*kernel_t)(wator_t *w);
+
+/** Le posizioni degli animali del pianeta di partenza, raccolte prima della
+    misura perché le regole spostano gli animali */
+static int *sharkPos, *fishPos;
+static long sharkCount, fishCount;
+
+static long bench_neighbor_cell(wator_t *w)
+{
+    int k, l;
+    long sum = 0;
+    for (int x = 0; x < (int) w->plan->nrow; x++)
+        for (int y = 0; y < (int) w->plan->ncol; y++)
+            for (motion_t m = UP; m <= RIGHT; m++)
+                sum += neighbor_cell(w->plan, x, y, m, &k, &l);
+    // Impedisce al compilatore di eliminare le chiamate
+    __asm__ volatile ("" : : "g" (sum) : "memory");
+    return (long) w->plan->nrow * w->plan->ncol;
+}
+
+static long bench_shark_rule1(wator_t *w)
+{
+    int k, l;
+    for (long i = 0; i < sharkCount; i++)
+        shark_rule1(w, sharkPos[2 * i], sharkPos[2 * i + 1], &k, &l);
+    return sharkCount;
+}
+
+static long bench_shark_rule2(wator_t *w)
+{
+    int k, l;
+    for (long i = 0; i < sharkCount; i++)
+        shark_rule2(w, sharkPos[2 * i], sharkPos[2 * i + 1], &k, &l);
+    return sharkCount;
+}
+
+static long bench_fish_rule3(wator_t *w)
+{
+    int k, l;
+    for (long i = 0; i < fishCount; i++)
+        fish_rule3(w, fishPos[2 * i], fishPos[2 * i + 1], &k, &l);
+    return fishCount;
+}
+
+static long bench_fish_rule4(wator_t *w)
+{
+    int k, l;
+    for (long i = 0; i < fishCount; i++)
+        fish_rule4(w, fishPos[2 * i], fishPos[2 * i + 1], &k, &l);
+    return fishCount;
+}
+
+static long bench_update_wator(wator_t *w)
+{
+    update_wator(w);
+    return (long) w->plan->nrow * w->plan->ncol;
+}
+
+static long bench_update_wator_rect(wator_t *w)
+{
+    wator_delta_t delta = {0, 0, 0, 0};
+    rect_t rect = {0, 0, w->plan->ncol, w->plan->nrow};
+    update_wator_rect(w, &rect, &delta);
+    return (long) w->plan->nrow * w->plan->ncol;
+}
+
+static const struct { const char *name; kernel_t run; } kernels[] = {
+    {"neighbor_cell", bench_neighbor_cell},
+    {"shark_rule1", bench_shark_rule1},
+    {"shark_rule2", bench_shark_rule2},
+    {"fish_rule3", bench_fish_rule3},
+    {"fish_rule4", bench_fish_rule4},
+    {"update_wator", bench_update_wator},
+    {"update_wator_rect", bench_update_wator_rect},
+};
+
+/** Genera un pianeta casuale side x side con le percentuali di squali e pesci
+    indicate e contatori casuali compatibili con i parametri di w */
+static planet_t *generate_planet(wator_t *w, int side, int sharks, int fish)
+{
+    planet_t *p = new_planet(side, side);
+    if (p == NULL)
+        return NULL;
+    for (int x = 0; x < side; x++)
+        for (int y = 0; y < side; y++) {
+            int r = rand() % 100;
+            if (r < sharks) {
+                p->w[x][y] = SHARK;
+                p->btime[x][y] = rand() % (w->sb + 1);
+                p->dtime[x][y] = rand() % (w->sd + 1);
+            }
+            else if (r < sharks + fish) {
+                p->w[x][y] = FISH;
+                p->btime[x][y] = rand() % (w->fb + 1);
+            }
+        }
+    return p;
+}
+
+/** Registra le posizioni degli animali del pianeta p in sharkPos e fishPos */
+static void collect_positions(planet_t *p)
+{
+    sharkCount = fishCount = 0;
+    for (int x = 0; x < (int) p->nrow; x++)
+        for (int y = 0; y < (int) p->ncol; y++) {
+            if (p->w[x][y] == SHARK) {
+                sharkPos[2 * sharkCount] = x;
+                sharkPos[2 * sharkCount++ + 1] = y;
+            }
+            else if (p->w[x][y] == FISH) {
+                fishPos[2 * fishCount] = x;
+                fishPos[2 * fishCount++ + 1] = y;
+            }
+        }
+}
+
+/** Ripristina in w il pianeta di partenza start e il chronon iniziale */
+static void restore(wator_t *w, planet_t *start)
+{
+    copy_planet_rows(w->plan, start, 0, start->nrow);
+    w->chronon = 0;
+    w->nf = fishCount;
+    w->ns = sharkCount;
+}
+
+static double elapsed_ns(struct timespec *from, struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1e9 + (to->tv_nsec - from->tv_nsec);
+}
+
+int main(void)
+{
+    wator_t w = {.sd = 6, .sb = 9, .fb = 3, .seed = BENCH_SEED};
+    srand(BENCH_SEED);
+
+    printf("kernel,rows,cols,density,halo,reps,cells,mean_ns_per_cell,stddev_ns_per_cell\n");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+        for (size_t d = 0; d < sizeof(densities) / sizeof(densities[0]); d++)
+            for (int halo = 0; halo <= 1; halo++) {
+                planet_t *start = generate_planet(&w, sizes[s], densities[d].sharks, densities[d].fish);
+                if (start == NULL || (halo && set_planet_halo(start, true) == -1)) {
+                    perror("Impossibile generare il pianeta");
+                    return EXIT_FAILURE;
+                }
+                sharkPos = malloc(2 * sizeof(int) * start->nrow * start->ncol);
+                fishPos = malloc(2 * sizeof(int) * start->nrow * start->ncol);
+                w.plan = new_planet_like(start);
+                if (sharkPos == NULL || fishPos == NULL || w.plan == NULL) {
+                    perror("Memoria insufficiente");
+                    return EXIT_FAILURE;
+                }
+                collect_positions(start);
+
+                for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+                    double sum = 0, sumSquares = 0;
+                    long cells = 0;
+                    for (int rep = -BENCH_WARMUP; rep < BENCH_REPS; rep++) {
+                        struct timespec from, to;
+                        restore(&w, start);
+                        clock_gettime(CLOCK_MONOTONIC, &from);
+                        cells = kernels[k].run(&w);
+                        clock_gettime(CLOCK_MONOTONIC, &to);
+                        if (rep < 0 || cells == 0)
+                            continue;
+                        double nsPerCell = elapsed_ns(&from, &to) / cells;
+                        sum += nsPerCell;
+                        sumSquares += nsPerCell * nsPerCell;
+                    }
+                    double mean = sum / BENCH_REPS;
+                    double variance = sumSquares / BENCH_REPS - mean * mean;
+                    printf("%s,%d,%d,%s,%d,%d,%ld,%.3f,%.3f\n", kernels[k].name, sizes[s], sizes[s],
+                           densities[d].name, halo, BENCH_REPS, cells, mean, variance > 0 ? sqrt(variance) : 0);
+                    fflush(stdout);
+                }
+
+                free_planet(w.plan);
+                free_planet(start);
+                free(sharkPos);
+                free(fishPos);
+            }
+    return EXIT_SUCCESS;
+}
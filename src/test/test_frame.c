@@ -0,0 +1,230 @@
+#include "frame.h"
+#include "wator.h"
+#include "unity.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+void setUp(void)
+{
+    // Eseguito prima di OGNI FUNZIONE di test
+}
+
+void tearDown(void)
+{
+    // Eseguito dopo OGNI FUNZIONE di test
+}
+
+/* Generatore pseudocasuale con seme fisso, così che i test siano ripetibili */
+static unsigned int next_random(unsigned int *state)
+{
+    *state = *state * 1103515245u + 12345u;
+    return *state >> 16;
+}
+
+/* Cambia changes celle a caso del pianeta p */
+static void mutate_planet(planet_t *p, int changes, unsigned int *state)
+{
+    for (int i = 0; i < changes; i++)
+        p->w[next_random(state) % p->nrow][next_random(state) % p->ncol] = next_random(state) % 3;
+}
+
+/* Codifica il pianeta p con e, decodifica il fotogramma con d e controlla che
+   le celle decodificate siano quelle di p. Restituisce il tipo del fotogramma */
+static int round_trip(frame_encoder_t *e, frame_decoder_t *d, planet_t *p)
+{
+    unsigned char *cells = malloc(frame_packed_length(p->nrow, p->ncol));
+    TEST_ASSERT_NOT_NULL(cells);
+    frame_pack(p, cells);
+
+    frame_header_t h;
+    const unsigned char *payload;
+    TEST_ASSERT_EQUAL(0, frame_encode(e, cells, p->nrow, p->ncol, &h, &payload));
+    TEST_ASSERT_EQUAL(p->nrow, h.nrow);
+    TEST_ASSERT_EQUAL(p->ncol, h.ncol);
+    TEST_ASSERT_EQUAL(0, frame_decode(d, &h, payload));
+    TEST_ASSERT_EQUAL(p->nrow, d->nrow);
+    TEST_ASSERT_EQUAL(p->ncol, d->ncol);
+    TEST_ASSERT_EQUAL(0, memcmp(cells, d->cells, frame_packed_length(p->nrow, p->ncol)));
+    free(cells);
+    return h.type;
+}
+
+void test_frame_pack_unpack()
+{
+    wator_t *wator = new_wator("test_data/esempio0.txt");
+    TEST_ASSERT_NOT_NULL(wator);
+    planet_t *p = wator->plan;
+    size_t count = (size_t) p->nrow * p->ncol;
+    TEST_ASSERT_EQUAL((count + 3) / 4, frame_packed_length(p->nrow, p->ncol));
+
+    unsigned char *plain = malloc(frame_packed_length(p->nrow, p->ncol));
+    unsigned char *haloed = malloc(frame_packed_length(p->nrow, p->ncol));
+    cell_t *cells = malloc(count * sizeof(cell_t));
+    TEST_ASSERT_TRUE(plain != NULL && haloed != NULL && cells != NULL);
+    frame_pack(p, plain);
+    TEST_ASSERT_EQUAL(0, frame_unpack(plain, cells, count));
+    for (unsigned int r = 0; r < p->nrow; r++)
+        for (unsigned int c = 0; c < p->ncol; c++)
+            TEST_ASSERT_EQUAL(p->w[r][c], cells[r * p->ncol + c]);
+
+    // Con il bordo fantasma le celle impacchettate non cambiano
+    TEST_ASSERT_EQUAL(0, set_planet_halo(p, true));
+    frame_pack(p, haloed);
+    TEST_ASSERT_EQUAL(0, memcmp(plain, haloed, frame_packed_length(p->nrow, p->ncol)));
+
+    // 3 non è una cella valida
+    plain[0] |= 3;
+    TEST_ASSERT_EQUAL(-1, frame_unpack(plain, cells, count));
+    TEST_ASSERT_EQUAL(EPROTO, errno);
+    free(plain);
+    free(haloed);
+    free(cells);
+    free_wator(wator);
+}
+
+void test_frame_key_interval()
+{
+    frame_encoder_t e = {0};
+    frame_decoder_t d = {0};
+    unsigned int state = 42;
+    planet_t *p = new_planet(30, 40);
+    TEST_ASSERT_NOT_NULL(p);
+    mutate_planet(p, 600, &state);
+
+    // Un FRAME_FULL, FRAME_KEY_INTERVAL FRAME_DELTA, poi di nuovo un FRAME_FULL
+    TEST_ASSERT_EQUAL(FRAME_FULL, round_trip(&e, &d, p));
+    for (int f = 1; f <= FRAME_KEY_INTERVAL; f++) {
+        mutate_planet(p, 1 + f % 7, &state);
+        TEST_ASSERT_EQUAL(FRAME_DELTA, round_trip(&e, &d, p));
+    }
+    mutate_planet(p, 3, &state);
+    TEST_ASSERT_EQUAL(FRAME_FULL, round_trip(&e, &d, p));
+
+    // Un fotogramma uguale al precedente è un FRAME_DELTA vuoto
+    TEST_ASSERT_EQUAL(FRAME_DELTA, round_trip(&e, &d, p));
+
+    // Dopo frame_encoder_reset il fotogramma è completo
+    frame_encoder_reset(&e);
+    TEST_ASSERT_EQUAL(FRAME_FULL, round_trip(&e, &d, p));
+    free_planet(p);
+    frame_encoder_free(&e);
+    free(d.cells);
+}
+
+void test_frame_size_change()
+{
+    frame_encoder_t e = {0};
+    frame_decoder_t d = {0};
+    unsigned int state = 7;
+    planet_t *small = new_planet(5, 9);
+    planet_t *large = new_planet(12, 21);
+    TEST_ASSERT_TRUE(small != NULL && large != NULL);
+    mutate_planet(small, 20, &state);
+    mutate_planet(large, 100, &state);
+
+    TEST_ASSERT_EQUAL(FRAME_FULL, round_trip(&e, &d, small));
+    mutate_planet(small, 1, &state);
+    TEST_ASSERT_EQUAL(FRAME_DELTA, round_trip(&e, &d, small));
+    TEST_ASSERT_EQUAL(FRAME_FULL, round_trip(&e, &d, large)); // Le dimensioni sono cambiate
+    mutate_planet(large, 2, &state);
+    TEST_ASSERT_EQUAL(FRAME_DELTA, round_trip(&e, &d, large));
+    TEST_ASSERT_EQUAL(FRAME_FULL, round_trip(&e, &d, small));
+
+    // Un FRAME_DELTA con dimensioni diverse da quelle del decodificatore non è valido
+    frame_header_t h = {.type = FRAME_DELTA, .nrow = large->nrow, .ncol = large->ncol, .length = 0};
+    TEST_ASSERT_EQUAL(-1, frame_decode(&d, &h, NULL));
+    TEST_ASSERT_EQUAL(EPROTO, errno);
+
+    // Così come un FRAME_FULL di lunghezza sbagliata
+    unsigned char cells[32] = {0};
+    h = (frame_header_t) {.type = FRAME_FULL, .nrow = small->nrow, .ncol = small->ncol, .length = sizeof(cells)};
+    TEST_ASSERT_EQUAL(-1, frame_decode(&d, &h, cells));
+    TEST_ASSERT_EQUAL(EPROTO, errno);
+    free_planet(small);
+    free_planet(large);
+    frame_encoder_free(&e);
+    free(d.cells);
+}
+
+void test_frame_oversized_delta()
+{
+    frame_encoder_t e = {0};
+    frame_decoder_t d = {0};
+    unsigned int state = 3;
+    planet_t *p = new_planet(16, 16);
+    TEST_ASSERT_NOT_NULL(p);
+
+    // Se cambiano tutte le celle un FRAME_DELTA sarebbe più lungo del FRAME_FULL
+    TEST_ASSERT_EQUAL(FRAME_FULL, round_trip(&e, &d, p));
+    for (unsigned int r = 0; r < p->nrow; r++)
+        for (unsigned int c = 0; c < p->ncol; c++)
+            p->w[r][c] = (r + c) % 2 ? SHARK : FISH;
+    TEST_ASSERT_EQUAL(FRAME_FULL, round_trip(&e, &d, p));
+
+    // Poche celle cambiate tornano a essere un FRAME_DELTA
+    mutate_planet(p, 4, &state);
+    TEST_ASSERT_EQUAL(FRAME_DELTA, round_trip(&e, &d, p));
+    free_planet(p);
+    frame_encoder_free(&e);
+    free(d.cells);
+}
+
+void test_frame_truncated_delta()
+{
+    frame_encoder_t e = {0};
+    frame_decoder_t d = {0};
+    unsigned int state = 11;
+    planet_t *p = new_planet(20, 20);
+    TEST_ASSERT_NOT_NULL(p);
+    mutate_planet(p, 150, &state);
+    TEST_ASSERT_EQUAL(FRAME_FULL, round_trip(&e, &d, p));
+
+    unsigned char cells[100];
+    frame_header_t h;
+    const unsigned char *payload;
+    mutate_planet(p, 10, &state);
+    frame_pack(p, cells);
+    TEST_ASSERT_EQUAL(0, frame_encode(&e, cells, p->nrow, p->ncol, &h, &payload));
+    TEST_ASSERT_EQUAL(FRAME_DELTA, h.type);
+    TEST_ASSERT_TRUE(h.length > 0);
+
+    // Senza l'ultimo byte il FRAME_DELTA non è valido, e lo è anche il successivo finché non arriva un FRAME_FULL
+    h.length--;
+    TEST_ASSERT_EQUAL(-1, frame_decode(&d, &h, payload));
+    TEST_ASSERT_EQUAL(EPROTO, errno);
+    h.length++;
+    TEST_ASSERT_EQUAL(-1, frame_decode(&d, &h, payload));
+    TEST_ASSERT_EQUAL(EPROTO, errno);
+
+    frame_encoder_reset(&e);
+    TEST_ASSERT_EQUAL(FRAME_FULL, round_trip(&e, &d, p));
+    free_planet(p);
+    frame_encoder_free(&e);
+    free(d.cells);
+}
+
+void test_frame_random_sequence()
+{
+    frame_encoder_t e = {0};
+    frame_decoder_t d = {0};
+    unsigned int state = 2015;
+    planet_t *p = new_planet(17, 23); // Celle non multiple di 4: l'ultimo byte è incompleto
+    TEST_ASSERT_NOT_NULL(p);
+
+    // Fotogrammi con poche o molte celle cambiate, in ordine pseudocasuale
+    int full = 0, delta = 0;
+    for (int f = 0; f < 500; f++) {
+        int changes = next_random(&state) % 8 == 0 ? 300 : next_random(&state) % 12;
+        mutate_planet(p, changes, &state);
+        if (round_trip(&e, &d, p) == FRAME_FULL)
+            full++;
+        else
+            delta++;
+    }
+    TEST_ASSERT_TRUE(full > 500 / (FRAME_KEY_INTERVAL + 1));
+    TEST_ASSERT_TRUE(delta > full);
+    free_planet(p);
+    frame_encoder_free(&e);
+    free(d.cells);
+}
@@ -0,0 +1,60 @@
+/* AUTOGENERATED FILE. DO NOT EDIT. */
+
+//=======Test Runner Used To Run Each Test Below=====
+#define RUN_TEST(TestFunc, TestLineNum) \
+{ \
+  Unity.CurrentTestName = #TestFunc; \
+  Unity.CurrentTestLineNumber = TestLineNum; \
+  Unity.NumberOfTests++; \
+  if (TEST_PROTECT()) \
+  { \
+      setUp(); \
+      TestFunc(); \
+  } \
+  if (TEST_PROTECT() && !TEST_IS_IGNORED) \
+  { \
+    tearDown(); \
+  } \
+  UnityConcludeTest(); \
+}
+
+//=======Automagically Detected Files To Include=====
+#include "unity.h"
+#include <setjmp.h>
+#include <stdio.h>
+#include "frame.h"
+#include "wator.h"
+
+//=======External Functions This Runner Calls=====
+extern void setUp(void);
+extern void tearDown(void);
+extern void test_frame_pack_unpack();
+extern void test_frame_key_interval();
+extern void test_frame_size_change();
+extern void test_frame_oversized_delta();
+extern void test_frame_truncated_delta();
+extern void test_frame_random_sequence();
+
+
+//=======Test Reset Option=====
+void resetTest(void);
+void resetTest(void)
+{
+  tearDown();
+  setUp();
+}
+
+
+//=======MAIN=====
+int main(void)
+{
+  UnityBegin("test_frame.c");
+  RUN_TEST(test_frame_pack_unpack, 53);
+  RUN_TEST(test_frame_key_interval, 86);
+  RUN_TEST(test_frame_size_change, 115);
+  RUN_TEST(test_frame_oversized_delta, 150);
+  RUN_TEST(test_frame_truncated_delta, 173);
+  RUN_TEST(test_frame_random_sequence, 207);
+
+  return (UnityEnd());
+}
@@ -30,6 +30,9 @@ extern void tearDown(void);
 extern void test_cell_to_char();
 extern void test_char_to_cell();
 extern void test_new_planet();
+extern void test_planet_layout();
+extern void test_planet_halo();
+extern void test_copy_planet_rows();
 extern void test_print_planet();
 extern void test_load_planet();
 extern void test_shark_rule1();
@@ -37,6 +40,8 @@ extern void test_shark_rule2();
 extern void test_fish_rule3();
 extern void test_fish_rule4();
 extern void test_move_cell();
+extern void test_cell_random();
+extern void test_update_wator_rect();
 
 
 //=======Test Reset Option=====
@@ -52,16 +57,21 @@ void resetTest(void)
 int main(void)
 {
   UnityBegin("test_wator.c");
-  RUN_TEST(test_cell_to_char, 14);
-  RUN_TEST(test_char_to_cell, 22);
-  RUN_TEST(test_new_planet, 30);
-  RUN_TEST(test_print_planet, 38);
-  RUN_TEST(test_load_planet, 59);
-  RUN_TEST(test_shark_rule1, 66);
-  RUN_TEST(test_shark_rule2, 86);
-  RUN_TEST(test_fish_rule3, 104);
-  RUN_TEST(test_fish_rule4, 121);
-  RUN_TEST(test_move_cell, 137);
+  RUN_TEST(test_cell_to_char, 15);
+  RUN_TEST(test_char_to_cell, 23);
+  RUN_TEST(test_new_planet, 31);
+  RUN_TEST(test_planet_layout, 39);
+  RUN_TEST(test_planet_halo, 59);
+  RUN_TEST(test_copy_planet_rows, 92);
+  RUN_TEST(test_print_planet, 119);
+  RUN_TEST(test_load_planet, 140);
+  RUN_TEST(test_shark_rule1, 147);
+  RUN_TEST(test_shark_rule2, 167);
+  RUN_TEST(test_fish_rule3, 185);
+  RUN_TEST(test_fish_rule4, 202);
+  RUN_TEST(test_move_cell, 218);
+  RUN_TEST(test_cell_random, 236);
+  RUN_TEST(test_update_wator_rect, 268);
 
   return (UnityEnd());
 }
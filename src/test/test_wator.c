@@ -1,5 +1,6 @@
 #include "wator.h"
 #include "unity.h"
+#include <stdlib.h>
 
 void setUp(void)
 {
@@ -35,6 +36,86 @@ void test_new_planet()
     TEST_ASSERT_EQUAL(WATER, planet->w[5][5]);
 }
 
+void test_planet_layout()
+{
+    planet_t *planet = new_planet(7, 13);
+    TEST_ASSERT_NOT_NULL(planet);
+
+    // Le matrici stanno in un unico blocco allineato e le righe sono viste sul blocco
+    TEST_ASSERT_EQUAL(0, (unsigned long) planet->slab % PLANET_ALIGNMENT);
+    TEST_ASSERT_EQUAL(0, (unsigned long) planet->bcells % PLANET_ALIGNMENT);
+    TEST_ASSERT_EQUAL(0, (unsigned long) planet->dcells % PLANET_ALIGNMENT);
+    TEST_ASSERT_TRUE(planet->w[6] == &planet->wcells[CELL_INDEX(planet, 6, 0)]);
+    TEST_ASSERT_TRUE(planet->btime[3] == &planet->bcells[CELL_INDEX(planet, 3, 0)]);
+
+    planet->w[4][12] = SHARK;
+    planet->dtime[4][12] = 5;
+    TEST_ASSERT_EQUAL(SHARK, planet->wcells[CELL_INDEX(planet, 4, 12)]);
+    TEST_ASSERT_EQUAL(5, planet->dcells[CELL_INDEX(planet, 4, 12)]);
+    TEST_ASSERT_EQUAL(1, shark_count(planet));
+    free_planet(planet);
+}
+
+void test_planet_halo()
+{
+    int destX, destY, haloX, haloY;
+    wator_t *wator = new_wator("test_data/esempio0.txt");
+    TEST_ASSERT_NOT_NULL(wator);
+    FILE *f = fopen("test_data/esempio0.txt", "r");
+    planet_t *plain = load_planet(f);
+    fclose(f);
+    TEST_ASSERT_NOT_NULL(plain);
+
+    // Con il bordo fantasma i vicini (anche riavvolti) non cambiano
+    TEST_ASSERT_EQUAL(0, set_planet_halo(wator->plan, true));
+    TEST_ASSERT_EQUAL(9, shark_count(wator->plan));
+    for (int r = 0; r < 10; r++)
+        for (int c = 0; c < 20; c++)
+            for (motion_t m = UP; m <= RIGHT; m++) {
+                TEST_ASSERT_EQUAL(neighbor_cell(plain, r, c, m, &destX, &destY),
+                                  neighbor_cell(wator->plan, r, c, m, &haloX, &haloY));
+                TEST_ASSERT_EQUAL(destX, haloX);
+                TEST_ASSERT_EQUAL(destY, haloY);
+            }
+
+    // Uno spostamento su un lato aggiorna anche la copia sul lato opposto
+    move_cell(wator->plan, 9, 0, 8, 0);
+    TEST_ASSERT_EQUAL(WATER, neighbor_cell(wator->plan, 0, 0, UP, &destX, &destY));
+    TEST_ASSERT_EQUAL(SHARK, neighbor_cell(wator->plan, 8, 19, RIGHT, &destX, &destY));
+
+    TEST_ASSERT_EQUAL(0, set_planet_halo(wator->plan, false));
+    TEST_ASSERT_EQUAL(SHARK, wator->plan->w[8][0]);
+    free_planet(plain);
+    free_wator(wator);
+}
+
+void test_copy_planet_rows()
+{
+    wator_t *wator = new_wator("test_data/esempio0.txt");
+    TEST_ASSERT_NOT_NULL(wator);
+    TEST_ASSERT_EQUAL(0, set_planet_halo(wator->plan, true));
+    wator->plan->btime[3][7] = 4;
+
+    planet_t *copy = new_planet_like(wator->plan);
+    TEST_ASSERT_NOT_NULL(copy);
+    TEST_ASSERT_TRUE(copy->halo && copy->stride == wator->plan->stride);
+    TEST_ASSERT_EQUAL(-1, copy_planet_rows(copy, wator->plan, 4, 11)); // Righe non valide
+
+    // Due fasce di righe (copiate anche da thread diversi) formano il pianeta intero
+    TEST_ASSERT_EQUAL(0, copy_planet_rows(copy, wator->plan, 4, 10));
+    TEST_ASSERT_EQUAL(0, copy_planet_rows(copy, wator->plan, 0, 4));
+    int fish = wator->nf;
+    replace_planet(wator->plan, copy);
+    TEST_ASSERT_EQUAL(fish, fish_count(wator->plan));
+    TEST_ASSERT_EQUAL(4, wator->plan->btime[3][7]);
+
+    // Il bordo fantasma è stato copiato con le righe
+    int destX, destY;
+    TEST_ASSERT_EQUAL(wator->plan->w[9][5], neighbor_cell(wator->plan, 0, 5, UP, &destX, &destY));
+    TEST_ASSERT_EQUAL(wator->plan->w[4][19], neighbor_cell(wator->plan, 4, 0, LEFT, &destX, &destY));
+    free_wator(wator);
+}
+
 void test_print_planet()
 {
     const char *tempFileName = "print_planet_test_output.txt";
@@ -151,3 +232,75 @@ void test_move_cell()
     TEST_ASSERT_EQUAL(FISH, p->w[5][11]);
     fclose(f);
 }
+
+void test_cell_random()
+{
+    wator_t *wator = new_wator("test_data/esempio0.txt");
+    TEST_ASSERT_NOT_NULL(wator);
+    TEST_ASSERT_EQUAL(DEFAULT_SEED, wator->seed);
+
+    // Stessi argomenti, stesso numero; sempre nell'intervallo richiesto
+    unsigned int first = cell_random(wator, 4, 7, 4);
+    TEST_ASSERT_EQUAL(first, cell_random(wator, 4, 7, 4));
+    int hits[3] = {0};
+    for (int r = 0; r < 10; r++)
+        for (int c = 0; c < 20; c++) {
+            unsigned int value = cell_random(wator, r, c, 3);
+            TEST_ASSERT_TRUE(value < 3);
+            hits[value]++;
+        }
+    TEST_ASSERT_TRUE(hits[0] > 0 && hits[1] > 0 && hits[2] > 0);
+
+    // Con lo stesso seme due simulazioni evolvono allo stesso modo
+    wator_t *twin = new_wator("test_data/esempio0.txt");
+    TEST_ASSERT_NOT_NULL(twin);
+    for (int i = 0; i < 20; i++) {
+        TEST_ASSERT_EQUAL(0, update_wator(wator));
+        TEST_ASSERT_EQUAL(0, update_wator(twin));
+    }
+    for (int r = 0; r < 10; r++)
+        for (int c = 0; c < 20; c++)
+            TEST_ASSERT_EQUAL(wator->plan->w[r][c], twin->plan->w[r][c]);
+    free_wator(twin);
+    free_wator(wator);
+}
+
+void test_update_wator_rect()
+{
+    wator_t *wator = new_wator("test_data/esempio0.txt");
+    TEST_ASSERT_NOT_NULL(wator);
+    wator->sb = wator->fb = 0; // Tutti provano a partorire
+
+    // Le variazioni della popolazione finiscono in delta, non nella simulazione
+    wator_delta_t delta = {0};
+    rect_t *rect = make_rect(0, 0, 20, 10);
+    TEST_ASSERT_EQUAL(0, update_wator_rect(wator, rect, &delta));
+    TEST_ASSERT_EQUAL(6, wator->nf);
+    TEST_ASSERT_EQUAL(9, wator->ns);
+    TEST_ASSERT_TRUE(delta.fishBorn > 0 && delta.sharkBorn > 0);
+
+    apply_delta(wator, &delta);
+    TEST_ASSERT_EQUAL(fish_count(wator->plan), wator->nf);
+    TEST_ASSERT_EQUAL(shark_count(wator->plan), wator->ns);
+    TEST_ASSERT_EQUAL(0, delta.fishBorn + delta.fishEaten + delta.sharkBorn + delta.sharkDead);
+
+    // Nello stesso chronon tutte le celle sono già state aggiornate...
+    cell_t before[10][20];
+    for (int r = 0; r < 10; r++)
+        for (int c = 0; c < 20; c++)
+            before[r][c] = wator->plan->w[r][c];
+    TEST_ASSERT_EQUAL(0, update_wator_rect(wator, rect, &delta));
+    for (int r = 0; r < 10; r++)
+        for (int c = 0; c < 20; c++)
+            TEST_ASSERT_EQUAL(before[r][c], wator->plan->w[r][c]);
+
+    // ... nel successivo si ricomincia, senza azzerare niente
+    wator->chronon++;
+    TEST_ASSERT_EQUAL(0, update_wator_rect(wator, rect, &delta));
+    apply_delta(wator, &delta);
+    TEST_ASSERT_EQUAL(fish_count(wator->plan), wator->nf);
+    TEST_ASSERT_EQUAL(shark_count(wator->plan), wator->ns);
+
+    free(rect);
+    free_wator(wator);
+}
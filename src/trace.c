@@ -0,0 +1,154 @@
+/** \file trace.c
+    \author Giorgio Vinciguerra
+    \date Giugno 2015
+    \copyright Copyright (c) 2015 Giorgio Vinciguerra. All rights reserved.
+    \note  Si dichiara che il contenuto di questo file è in ogni sua parte opera
+           originale dell' autore.
+    \brief File contenente l'implementazione della registrazione della
+           cronologia dell'esecuzione.
+*/
+
+#include "trace.h"
+#include "phases.h"
+#include "utils.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+/* Un evento registrato */
+typedef struct trace_record {
+    unsigned long long start, end;
+    int fromRow, fromCol, rows, cols; // il rettangolo, se fromRow >= 0
+    int batch;
+    int chronon;
+    trace_kind_t kind;
+} trace_record_t;
+
+/* Il buffer degli eventi di un thread. Ogni buffer è scritto solo dal suo
+   thread, e letto da save_trace quando i thread sono terminati */
+typedef struct trace_buffer {
+    trace_record_t *records;
+    long count;
+    unsigned long dropped;  // n° di eventi scartati perché il buffer era pieno
+    int id;                 // la riga della cronologia
+    struct trace_buffer *next;
+    char padding[64];
+} trace_buffer_t;
+
+bool traceEnabled = false;
+
+static __thread trace_buffer_t *threadBuffer = NULL;
+
+static trace_buffer_t *buffers = NULL;  // i buffer di tutti i thread, in lista
+static pthread_mutex_t buffersMutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long long traceStart;   // istante di attivazione, origine dei tempi
+
+/* I nomi degli eventi, per tipo */
+static const char *kindNames[] = {"update", "dispatch", "batch", "chronon"};
+
+void setup_trace()
+{
+    traceStart = phase_now();
+    traceEnabled = true;
+}
+
+void trace_thread(int id)
+{
+    if (!traceEnabled)
+        return;
+
+    trace_buffer_t *b;
+    NOT_NULL_OR_FAIL(calloc(1, sizeof(trace_buffer_t)), b, "Impossibile allocare i buffer della cronologia");
+    NOT_NULL_OR_FAIL(malloc(TRACE_EVENTS * sizeof(trace_record_t)), b->records,
+                     "Impossibile allocare i buffer della cronologia");
+    b->id = id;
+    pthread_mutex_lock(&buffersMutex);
+    b->next = buffers;
+    buffers = b;
+    pthread_mutex_unlock(&buffersMutex);
+    threadBuffer = b;
+}
+
+void trace_event(trace_kind_t kind, unsigned long long start, unsigned long long end,
+                 rect_t *rect, int batch, int chronon)
+{
+    trace_buffer_t *b = threadBuffer;
+    if (b == NULL)
+        return;
+    if (b->count == TRACE_EVENTS) {
+        b->dropped++;
+        return;
+    }
+
+    trace_record_t *r = &b->records[b->count++];
+    r->start = start;
+    r->end = end;
+    r->kind = kind;
+    r->batch = batch;
+    r->chronon = chronon;
+    r->fromRow = rect ? rect->fromRow : -1;
+    r->fromCol = rect ? rect->fromCol : -1;
+    r->rows = rect ? rect->rows : 0;
+    r->cols = rect ? rect->cols : 0;
+}
+
+/* Scrive su f il nome name della riga della cronologia tid (la riga 0 è la prima scritta) */
+static void print_thread_name(FILE *f, int tid, const char *name, int number)
+{
+    fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"",
+            tid == 0 ? "" : ",\n", tid);
+    fprintf(f, name, number);
+    fprintf(f, "\"}},\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"sort_index\":%d}}", tid, tid);
+}
+
+int save_trace(const char *path)
+{
+    if (!traceEnabled)
+        return 0;
+
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+        return -1; // errno settato da fopen
+
+    // Una riga per worker, seguite da quelle di dispatcher e collector e da una per la durata dei batch
+    int workers = 0;
+    for (trace_buffer_t *b = buffers; b != NULL; b = b->next)
+        if (b->id >= workers)
+            workers = b->id + 1;
+    int dispatcherRow = workers, collectorRow = workers + 1, batchRow = workers + 2;
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (int w = 0; w < workers; w++)
+        print_thread_name(f, w, "worker %d", w);
+    print_thread_name(f, dispatcherRow, "dispatcher", 0);
+    print_thread_name(f, collectorRow, "collector", 0);
+    print_thread_name(f, batchRow, "batch", 0);
+
+    unsigned long dropped = 0;
+    while (buffers != NULL) {
+        trace_buffer_t *b = buffers;
+        int row = b->id == TRACE_DISPATCHER ? dispatcherRow : b->id == TRACE_COLLECTOR ? collectorRow : b->id;
+        dropped += b->dropped;
+        for (long i = 0; i < b->count; i++) {
+            trace_record_t *r = &b->records[i];
+            fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+                    "\"args\":{\"chronon\":%d,\"batch\":%d",
+                    kindNames[r->kind], r->kind == TRACE_TASK ? "task" : "farm", r->kind == TRACE_BATCH ? batchRow : row,
+                    (r->start - traceStart) / 1e3, (r->end - r->start) / 1e3, r->chronon, r->batch);
+            if (r->fromRow >= 0)
+                fprintf(f, ",\"row\":%d,\"col\":%d,\"rows\":%d,\"cols\":%d", r->fromRow, r->fromCol, r->rows, r->cols);
+            fprintf(f, "}}");
+        }
+        buffers = b->next;
+        free(b->records);
+        free(b);
+    }
+    fprintf(f, "\n]}\n");
+    traceEnabled = false;
+
+    if (dropped > 0)
+        fprintf(stderr, "Cronologia: %lu eventi scartati perché i buffer erano pieni\n", dropped);
+    if (fclose(f) != 0)
+        return -1; // errno settato da fclose
+    return 0;
+}
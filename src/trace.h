@@ -0,0 +1,74 @@
+/** \file trace.h
+    \author Giorgio Vinciguerra
+    \date Giugno 2015
+    \copyright Copyright (c) 2015 Giorgio Vinciguerra. All rights reserved.
+    \note  Si dichiara che il contenuto di questo file è in ogni sua parte opera
+           originale dell' autore.
+    \brief File contenente i prototipi delle funzioni che registrano la
+           cronologia dell'esecuzione della simulazione.
+
+    Se la registrazione è attiva (opzione -x di wator), ogni thread scrive in
+    un proprio buffer un evento per ogni task eseguito e per ogni fase della
+    farm (inserimento di un batch in coda, durata di un batch, chiusura di un
+    chronon). I buffer non sono condivisi, quindi non servono lock. Al termine
+    della simulazione (anche quelli dei thread già terminati, per esempio dopo
+    un cambio del numero di worker) gli eventi vengono salvati nel formato JSON "trace event"
+    di Chrome (visualizzabile con chrome://tracing o Perfetto), in cui ogni
+    thread è una riga della cronologia.
+*/
+
+#ifndef __TRACE__H
+#define __TRACE__H
+
+#include "wator.h"
+#include <stdbool.h>
+
+/** Numero massimo di eventi registrati da un thread. Quelli successivi vengono
+    scartati e contati */
+#define TRACE_EVENTS (1 << 18)
+
+/** Identificativi delle righe della cronologia di dispatcher e collector (le
+    righe dei worker sono identificate dal loro numero) */
+#define TRACE_DISPATCHER -1
+#define TRACE_COLLECTOR -2
+
+/** I tipi di evento:
+    TRACE_TASK aggiornamento di un rettangolo da parte di un worker
+    TRACE_DISPATCH inserimento in coda di un batch da parte del dispatcher
+    TRACE_BATCH un batch, dall'inizio al completamento dell'ultimo task
+    TRACE_CHRONON chiusura di un chronon (complete_chronon) */
+typedef enum {TRACE_TASK, TRACE_DISPATCH, TRACE_BATCH, TRACE_CHRONON} trace_kind_t;
+
+/** true se la registrazione è attiva */
+extern bool traceEnabled;
+
+/** Attiva la registrazione. Va chiamata prima di creare i thread. */
+void setup_trace();
+
+/** Se la registrazione è attiva, alloca un buffer per il thread corrente,
+    i cui eventi andranno nella riga id della cronologia. Gli eventi dei
+    thread senza buffer non vengono registrati.
+    \param id il n° del worker, oppure TRACE_DISPATCHER o TRACE_COLLECTOR
+ */
+void trace_thread(int id);
+
+/** Registra un evento del thread corrente, se la registrazione è attiva.
+    \param kind il tipo di evento
+    \param start l'istante di inizio (vedi phase_now)
+    \param end l'istante di fine
+    \param rect il rettangolo aggiornato, o NULL
+    \param batch il batch dell'evento, o -1
+    \param chronon il chronon dell'evento
+ */
+void trace_event(trace_kind_t kind, unsigned long long start, unsigned long long end,
+                 rect_t *rect, int batch, int chronon);
+
+/** Salva gli eventi registrati nel file path, in formato JSON, e libera i
+    buffer.
+    \param path il percorso del file
+    \return 0 se tutto e' andato bene
+    \return -1 se si e' verificato un errore (setta errno)
+ */
+int save_trace(const char *path);
+
+#endif
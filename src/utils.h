@@ -36,6 +36,16 @@
 // FINE definizioni attive solo in fase di debug
 
 
+/** Macro da usare nei cicli di attesa attiva: suggerisce al processore che il
+    thread sta aspettando (riducendo consumi e contesa con l'altro thread
+    dello stesso core), dove l'architettura lo permette.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+  #define CPU_RELAX() __builtin_ia32_pause()
+#else
+  #define CPU_RELAX()
+#endif
+
 /** Macro per la conversione di una stringa in unsigned long. Se non ha successo
     termina il programma
  */
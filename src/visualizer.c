@@ -18,69 +18,54 @@
 #include "utils.h"
 #include "wator.h"
 #include "visualizer.h"
+#include "frame.h"
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
 #include <limits.h>
+#include <poll.h>
 #include <sys/un.h>
 #include <sys/socket.h>
 
 static int visualizerSocket;         // Il socket wator <-> visualizer
-static cell_t **planetMatrix;        // La matrice che va riempita con i messaggi di wator
+static cell_t *planetMatrix;         // La matrice (per righe, contigua) che va riempita con i messaggi di wator
+static unsigned char *payload;       // Il contenuto dell'ultimo fotogramma ricevuto
+static size_t payloadCapacity;       // La dimensione di payload
+static frame_decoder_t decoder;      // Le celle impacchettate del pianeta, aggiornate da ogni fotogramma
+static const frame_ring_t *ring;     // L'anello in memoria condivisa ricevuto da wator, se c'è
+static uint64_t ringRead;            // Il n° di fotogrammi pubblicati nell'anello all'ultima lettura
 static char *dumpFile;               // Indica il file su cui effettuare il dump
 static volatile bool mustTerminate;  // Flag che diventa true all'arrivo di SIGUSR2
 
-/** Alloca una nuova matrice del pianeta di nrow*ncol celle. Se non ha successo
-    ritorna false, altrimenti modifica la variabile globale planetMatrix
-    e ritorna true.
+/** Alloca una nuova matrice del pianeta di nrow*ncol celle in un unico blocco
+    contiguo. Se non ha successo ritorna false, altrimenti modifica la variabile
+    globale planetMatrix e ritorna true.
  */
 bool new_planet_matrix(unsigned int nrow, unsigned int ncol)
 {
     static unsigned savedNrow = 0, savedNcol = 0;
     if (savedNrow == nrow && savedNcol == ncol)
         return true; // Matrice di quelle dimensioni già allocata
-    else {
-        if (planetMatrix) {
-            for (int i = 0; i < nrow; i++)
-                free(planetMatrix[i]);
-            free(planetMatrix);
-            planetMatrix = NULL;
-        }
-    }
 
-    planetMatrix = (cell_t **) malloc(nrow * sizeof(cell_t *));
-    if (planetMatrix == NULL)
-        return false;
-
-    bool outOfMemory = false; // true se una malloc ha fallito
-    unsigned int row = 0;     // È qui perché essere visibile al codice di pulizia
-    for (; row < nrow; row++) {
-        planetMatrix[row] = (cell_t *) malloc(ncol * sizeof(cell_t));
-        if (planetMatrix[row] == NULL) {
-            outOfMemory = true;
-            break;
-        }
-    }
-
-    if (outOfMemory) { // Una malloc ha fallito, fa pulizia
-        for (unsigned int i = 0; i < row; i++)
-            free(planetMatrix[i]);
-        free(planetMatrix);
+    free(planetMatrix);
+    planetMatrix = (cell_t *) malloc((size_t) nrow * ncol * sizeof(cell_t));
+    if (planetMatrix == NULL) {
+        savedNrow = savedNcol = 0;
         return false;
     }
 
+    savedNrow = nrow;
+    savedNcol = ncol;
     return true;
 }
 
 /** Effettua al più MAX_CONNECTION_ATTEMPTS tentativi di connessione al socket
-    con il processo wator. Se la connessione è stata stabilita e i messaggi
-    iniziali (dimensioni della matrice di simulazione) sono stati scambiati con
-    successo, modifica gli argomenti con la dimensione della matrice e
-    ritorna true, altrimenti ritorna false.
+    con il processo wator, interrompendoli se arriva SIGUSR2. Ritorna true se
+    la connessione è stata stabilita, altrimenti false.
  */
-bool connect_to_socket(unsigned int *nrow, unsigned int *ncol)
+bool connect_to_socket()
 {
     struct sockaddr_un sockaddr = {.sun_family = AF_UNIX};
     strncpy(sockaddr.sun_path, SOCKET_PATH, sizeof(sockaddr.sun_path));
@@ -89,7 +74,7 @@ bool connect_to_socket(unsigned int *nrow, unsigned int *ncol)
     int attempts = 1;
     while (-1 == connect(visualizerSocket, (struct sockaddr*) &sockaddr, sizeof(sockaddr))) {
         perror("Errore");
-        if (attempts <= MAX_CONNECTION_ATTEMPTS) {
+        if (attempts <= MAX_CONNECTION_ATTEMPTS && !mustTerminate) {
             DEBUG_PRINTF("Non riesco a connettermi al server. Tentativo %d di %d\n", attempts, MAX_CONNECTION_ATTEMPTS);
             sleep(DELAY_BETWEEN_CONNECTIONS);
         }
@@ -97,42 +82,92 @@ bool connect_to_socket(unsigned int *nrow, unsigned int *ncol)
             return false;
         attempts++;
     }
-    if (-1 == recv(visualizerSocket, nrow, MESSAGE_TYPE1_LENGTH, 0) ||
-        -1 == recv(visualizerSocket, ncol, MESSAGE_TYPE1_LENGTH, 0) ||
-        *nrow < 1 || *ncol < 1)
-        return false;
-
     return true;
 }
 
-/** Macro che calcola la prossima posizione di un carattere all'interno della
-    matrice del pianeta. */
-#define NEXT(r, c) { if(c==ncol-1) {c=0;r++;} else c++; }
-
-/** Legge i dati dal socket. Ogni byte ricevuto rappresenta una cella con cui
-    verrà riempita planetMatrix.
+/** Copia nella matrice planetMatrix le celle impacchettate cells del pianeta
+    descritto da h.
 
     \return true se la matrice è stata riempita, altrimenti false.
  */
-bool read_from_socket(unsigned int nrow, unsigned int ncol)
+bool fill_planet_matrix(const frame_header_t *h, const unsigned char *cells)
+{
+    if (!new_planet_matrix(h->nrow, h->ncol)) {
+        perror("Impossibile allocare la matrice del pianeta");
+        return false;
+    }
+    return 0 == frame_unpack(cells, planetMatrix, (size_t) h->nrow * h->ncol);
+}
+
+/** Attende che wator pubblichi un nuovo fotogramma nell'anello, controllandolo
+    ogni FRAME_RING_POLL_MS millisecondi, e ne copia le celle in planetMatrix.
+
+    \return true se la matrice è stata riempita, false se wator ha chiuso la
+            connessione o se il fotogramma non è valido.
+ */
+bool read_from_ring(frame_header_t *h)
 {
-    ssize_t totalByteRead;
-
-    char buffer[MESSAGE_TYPE2_LENGTH];
-    int currRow = 0, currCol = 0;
-    while ((totalByteRead = recv(visualizerSocket, buffer, MESSAGE_TYPE2_LENGTH, 0)) != -1 || errno == EINTR) {
-        if (totalByteRead == 0)
-            continue;
-
-        for (size_t i = 0; i < totalByteRead; i++) {
-            planetMatrix[currRow][currCol] = char_to_cell(buffer[i]);
-            if (currRow == nrow - 1 && currCol == ncol - 1)
-                return 1; // Matrice riempita
-            else
-                NEXT(currRow, currCol);
+    struct pollfd pfd = {.fd = visualizerSocket, .events = POLLIN};
+    while (!mustTerminate) {
+        if (frame_ring_read(ring, &ringRead, h, payload)) {
+            if (frame_packed_length(h->nrow, h->ncol) != ring->slotLength) {
+                fprintf(stderr, "Fotogramma non valido nell'anello (%ux%u)\n", h->nrow, h->ncol);
+                return false;
+            }
+            return fill_planet_matrix(h, payload);
         }
+        if (poll(&pfd, 1, FRAME_RING_POLL_MS) > 0)
+            return false; // Su questa connessione wator non invia altro: è stata chiusa
     }
-    return 0; // Matrice non riempita
+    return false;
+}
+
+/** Riceve un fotogramma dal socket, lo applica alle celle ricevute finora e le
+    copia in planetMatrix. Se il fotogramma consegna un anello in memoria
+    condivisa, da quel momento i fotogrammi vengono letti dall'anello.
+
+    \return true se la matrice è stata riempita, false se la connessione è
+            stata chiusa o se il fotogramma non è valido.
+ */
+bool read_from_socket(frame_header_t *h)
+{
+    if (ring != NULL)
+        return read_from_ring(h);
+
+    int passedFd;
+    if (-1 == frame_recv(visualizerSocket, h, &payload, &payloadCapacity, &passedFd)) {
+        if (errno != 0)
+            perror("Errore nella ricezione di un fotogramma");
+        return false;
+    }
+    if (h->type == FRAME_RING) {
+        ring = passedFd == -1 ? NULL : frame_ring_map(passedFd);
+        if (passedFd != -1)
+            close(passedFd); // La mappatura resta valida anche senza descrittore
+        if (ring == NULL) {
+            perror("Impossibile leggere l'anello dei fotogrammi");
+            return false;
+        }
+        if (ring->slotLength > payloadCapacity) {
+            unsigned char *larger = realloc(payload, ring->slotLength);
+            if (larger == NULL) {
+                perror("Impossibile allocare il buffer dei fotogrammi");
+                return false;
+            }
+            payload = larger;
+            payloadCapacity = ring->slotLength;
+        }
+        ringRead = 0;
+        return read_from_ring(h);
+    }
+
+    if (passedFd != -1)
+        close(passedFd);
+    if (-1 == frame_decode(&decoder, h, payload)) {
+        fprintf(stderr, "Fotogramma non valido (tipo %d, %ux%u)\n", h->type, h->nrow, h->ncol);
+        return false;
+    }
+    return fill_planet_matrix(h, decoder.cells);
 }
 
 /** Funzione che gestisce l'arrivo del segnale di terminazione SIGUSR2. */
@@ -141,19 +176,22 @@ void terminate(int sig)
     mustTerminate = true;
 }
 
-/** Esegue la stampa della matrice del pianeta su schermo o su file. */
-void print_or_dump_planet_matrix(unsigned int nrow, unsigned int ncol)
+/** Esegue la stampa della matrice del pianeta su schermo (con il chronon e
+    la popolazione) o su file. */
+void print_or_dump_planet_matrix(const frame_header_t *h)
 {
+    unsigned int nrow = h->nrow, ncol = h->ncol;
     FILE *destStream = stdout;
     if (dumpFile != NULL && NULL == (destStream = fopen(dumpFile, "w"))) {
         perror("Non è stato possibile salvare lo stato della matrice");
         return;
     }
 
-    planet_t tmpPlan = {.w = planetMatrix, .nrow = nrow, .ncol = ncol};
+    planet_t tmpPlan = {.wcells = planetMatrix, .nrow = nrow, .ncol = ncol, .stride = ncol};
     if (destStream == stdout) {
         if (system("clear") != -1)
             print_planet_colored(&tmpPlan);
+        printf("Chronon %llu: %u pesci, %u squali\n", (unsigned long long) h->chronon, h->nf, h->ns);
         fflush(stdout);
     }
     else {
@@ -184,12 +222,18 @@ int main(int argc, char *argv[])
     sa.sa_handler = terminate;
     SC_OR_FAIL(sigaction(SIGUSR2, &sa, NULL), retval, "Impossibile gestire i segnali in visualizer");
 
-    unsigned int nrow = UINT_MAX; // Numero di colonne della matrice
-    unsigned int ncol = UINT_MAX; // Numero di righe della matrice
+    // La connessione resta aperta finché wator invia fotogrammi, poi il visualizer si riconnette
+    frame_header_t h;
     while (!mustTerminate) {
-        if (connect_to_socket(&nrow, &ncol) && new_planet_matrix(nrow, ncol) && read_from_socket(nrow, ncol))
-            print_or_dump_planet_matrix(nrow, ncol);
+        decoder.nrow = decoder.ncol = 0; // Su una nuova connessione il primo fotogramma è completo
+        if (connect_to_socket())
+            while (!mustTerminate && read_from_socket(&h))
+                print_or_dump_planet_matrix(&h);
         close(visualizerSocket);
+        if (ring != NULL) {
+            frame_ring_unmap(ring);
+            ring = NULL;
+        }
     }
 
     DEBUG_PRINT("Visualizer sta per terminare...\n");
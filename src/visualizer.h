@@ -11,17 +11,78 @@
 #ifndef __VISUALIZER__H
 #define __VISUALIZER__H
 
-/** Macro che indica la dimensione di un messaggio che contiene il numero di
-    righe (o di colonne) della matrice. Questo tipo di messaggio è scambiato
-    2 volte (una per ogni dimensione della matrice) appena i due processi si
-    connettono. I successivi messaggi hanno dimensione MESSAGE_TYPE2_LENGTH.
- */
-#define MESSAGE_TYPE1_LENGTH sizeof(unsigned int)
+#include <stdint.h>
 
-/** Macro che indica la dimensione di un messaggio che contiene le celle di una
-    matrice.
- */
-#define MESSAGE_TYPE2_LENGTH (size_t)512
+/** I due processi restano connessi per tutta la simulazione: per ogni
+    chronon da visualizzare wator invia un fotogramma, formato da
+    un'intestazione frame_header_t seguita da length byte di contenuto. Se la
+    connessione si interrompe il visualizer si riconnette e wator ne accetta
+    una nuova al fotogramma successivo. */
+
+/** Valore del campo magic di ogni intestazione ("WTOR") */
+#define FRAME_MAGIC 0x524f5457u
+
+/** Versione del protocollo. Un visualizer che riceve una versione diversa
+    dalla propria chiude la connessione */
+#define FRAME_VERSION 3
+
+/** I tipi di fotogramma:
+    FRAME_FULL tutte le celle del pianeta, impacchettate (vedi frame.h). Il
+    primo fotogramma di una connessione è sempre di questo tipo.
+    FRAME_DELTA le celle impacchettate che differiscono da quelle del
+    fotogramma precedente della stessa connessione: una sequenza di coppie
+    (salto, n) di interi senza segno in formato varint (7 bit per byte, a
+    partire dai meno significativi; il bit più alto indica che segue un altro
+    byte), ciascuna seguita da n byte. Partendo dall'inizio delle celle
+    impacchettate si lasciano invariati salto byte e si sostituiscono gli n
+    successivi con quelli ricevuti. Pianeta e dimensioni non cambiano.
+    FRAME_RING nessun contenuto: il messaggio porta con sé (SCM_RIGHTS) il
+    descrittore della memoria condivisa in cui wator pubblica i fotogrammi
+    (vedi frame_ring_t). È l'unico fotogramma inviato sulla connessione, che
+    resta aperta finché wator non termina. */
+typedef enum {FRAME_FULL = 1, FRAME_DELTA = 2, FRAME_RING = 3} frame_type_t;
+
+/** L'intestazione di un fotogramma */
+typedef struct frame_header {
+    uint32_t magic;     // FRAME_MAGIC
+    uint16_t version;   // FRAME_VERSION
+    uint16_t type;      // un frame_type_t
+    uint32_t nrow, ncol;
+    uint64_t chronon;
+    uint32_t nf, ns;    // n° di pesci e di squali
+    uint32_t length;    // n° di byte del contenuto che segue
+    uint32_t reserved;  // 0
+} frame_header_t;
+
+/** N° di fotogrammi dell'anello in memoria condivisa */
+#define FRAME_RING_SLOTS 4
+
+/** Intervallo, in millisecondi, tra due controlli dell'anello da parte del
+    visualizer */
+#define FRAME_RING_POLL_MS 20
+
+/** Una posizione dell'anello. Il campo sequence fa da seqlock: è dispari
+    mentre wator scrive il fotogramma e cambia a ogni scrittura, così che chi
+    legge riconosca un fotogramma sovrascritto durante la lettura */
+typedef struct frame_slot {
+    uint64_t sequence;
+    frame_header_t header;  // di tipo FRAME_FULL
+} frame_slot_t;
+
+/** L'anello di fotogrammi in memoria condivisa (opzione -m di wator), che il
+    visualizer mappa in sola lettura. Le celle impacchettate della posizione
+    s occupano slotLength byte a partire da sizeof(frame_ring_t) + s *
+    slotLength. wator non attende mai chi legge: un visualizer lento perde
+    fotogrammi, ma vede sempre il più recente */
+typedef struct frame_ring {
+    uint32_t magic;         // FRAME_MAGIC
+    uint16_t version;       // FRAME_VERSION
+    uint16_t slots;         // FRAME_RING_SLOTS
+    uint32_t slotLength;
+    uint32_t reserved;
+    uint64_t published;     // n° di fotogrammi pubblicati: l'ultimo è nella posizione (published - 1) % slots
+    frame_slot_t slot[FRAME_RING_SLOTS];
+} frame_ring_t;
 
 /** Stringa che rappresenta il path del socket che connette i due processi. */
 #define SOCKET_PATH "/tmp/visual.sck"
@@ -21,6 +21,8 @@
  Per lo stesso motivo in wator.c non ci sono chiamate abort() o exit().
  */
 
+#define _POSIX_C_SOURCE 200112L // Per posix_memalign anche quando si compila con -std=c99
+
 #include "wator.h"
 #include "utils.h"
 #include <errno.h>
@@ -47,64 +49,159 @@ inline int char_to_cell(char c)
     }
 }
 
-planet_t *new_planet(unsigned int nrows, unsigned int ncols)
+/* Arrotonda size al primo multiplo di PLANET_ALIGNMENT */
+#define ALIGN_UP(size) (((size) + PLANET_ALIGNMENT - 1) / PLANET_ALIGNMENT * PLANET_ALIGNMENT)
+
+/* Alloca un pianeta di nrows*ncols celle. Se halo è true le matrici hanno
+   una cornice di una cella per lato (il bordo fantasma) e le celle
+   (0,0)...(nrows-1,ncols-1) ne occupano la parte interna. Se init è false le
+   matrici non vengono scritte (le celle hanno un contenuto indefinito). */
+static planet_t *alloc_planet(unsigned int nrows, unsigned int ncols, bool halo, bool init)
 {
     if (nrows == 0 || ncols == 0)
         return NULL;
 
-    int **btimeMatrix;
-    int **dtimeMatrix;
-    if (0 != alloc_counters_matrices(nrows, ncols, &btimeMatrix, &dtimeMatrix))
+    planet_t *thePlanet = (planet_t *) malloc(sizeof(planet_t));
+    if (thePlanet == NULL)
         return NULL;
 
-    planet_t *thePlanet = (planet_t *) malloc(sizeof(planet_t));
-    cell_t **planetMatrix = (cell_t **) malloc(nrows * sizeof(cell_t *));
-    if (thePlanet == NULL || planetMatrix == NULL) {
+    /* Tutte le matrici (e i vettori di puntatori alle loro righe) stanno in
+       un'unica allocazione, in cui ogni blocco inizia su una linea di cache:
+       [ celle | btime | dtime | aggiornamenti | righe w | righe btime | righe dtime ] */
+    size_t border      = halo ? 1 : 0;
+    size_t stride      = ncols + 2 * border;
+    size_t cells       = (nrows + 2 * border) * stride;
+    size_t wcellsSize  = ALIGN_UP(cells * sizeof(cell_t));
+    size_t countsSize  = ALIGN_UP(cells * sizeof(int));
+    size_t stampsSize  = ALIGN_UP(cells * sizeof(unsigned int));
+    size_t rowPtrsSize = ALIGN_UP(nrows * sizeof(void *));
+    size_t rowPtrsFrom = wcellsSize + 2 * countsSize + stampsSize;
+    char *slab;
+    if (0 != posix_memalign((void **) &slab, PLANET_ALIGNMENT, rowPtrsFrom + 3 * rowPtrsSize)) {
+        DEBUG_PRINTF("Non è stato possibile allocare un pianeta %ux%u.\n", nrows, ncols);
         free(thePlanet);
-        free(planetMatrix);
+        errno = ENOMEM;
         return NULL;
     }
 
-    bool outOfMemory = false; // true se una malloc ha fallito
-    unsigned int row = 0;     // È qui perché essere visibile al codice di pulizia
-    for (; row < nrows; row++) {
-        planetMatrix[row] = (cell_t *) malloc(ncols * sizeof(cell_t));
-        if (planetMatrix[row] == NULL) {
-            outOfMemory = true;
-            DEBUG_PRINTF("Non è stato possibile allocare la riga %d.\n", row);
-            break;
-        }
-        for (unsigned int col = 0; col < ncols; col++)
-            planetMatrix[row][col] = WATER;
+    size_t origin = border * stride + border; // Indice della cella (0,0) nei blocchi
+    thePlanet->slab   = slab;
+    thePlanet->nrow   = nrows;
+    thePlanet->ncol   = ncols;
+    thePlanet->stride = stride;
+    thePlanet->halo   = halo;
+    thePlanet->wcells = (cell_t *) slab + origin;
+    thePlanet->bcells = (int *) (slab + wcellsSize) + origin;
+    thePlanet->dcells = (int *) (slab + wcellsSize + countsSize) + origin;
+    thePlanet->ucells = (unsigned int *) (slab + wcellsSize + 2 * countsSize) + origin;
+    thePlanet->w      = (cell_t **) (slab + rowPtrsFrom);
+    thePlanet->btime  = (int **) (slab + rowPtrsFrom + rowPtrsSize);
+    thePlanet->dtime  = (int **) (slab + rowPtrsFrom + 2 * rowPtrsSize);
+
+    if (init) {
+        cell_t *allCells = (cell_t *) slab;
+        for (size_t i = 0; i < cells; i++)
+            allCells[i] = WATER;
+        memset(slab + wcellsSize, 0, 2 * countsSize + stampsSize);
+    }
+    for (unsigned int row = 0; row < nrows; row++) {
+        thePlanet->w[row]     = &thePlanet->wcells[CELL_INDEX(thePlanet, row, 0)];
+        thePlanet->btime[row] = &thePlanet->bcells[CELL_INDEX(thePlanet, row, 0)];
+        thePlanet->dtime[row] = &thePlanet->dcells[CELL_INDEX(thePlanet, row, 0)];
     }
 
-    if (outOfMemory) { // Una malloc ha fallito, fa pulizia
-        for (unsigned int i = 0; i < row; i++)
-            free(planetMatrix[i]);
-        free(planetMatrix);
-        free(thePlanet);
+    return thePlanet;
+}
+
+planet_t *new_planet(unsigned int nrows, unsigned int ncols)
+{
+    return alloc_planet(nrows, ncols, false, true);
+}
+
+planet_t *new_planet_like(planet_t *p)
+{
+    if (p == NULL) {
+        errno = EINVAL;
         return NULL;
     }
+    return alloc_planet(p->nrow, p->ncol, p->halo, false);
+}
 
-    thePlanet->w     = planetMatrix;
-    thePlanet->nrow  = nrows;
-    thePlanet->ncol  = ncols;
-    thePlanet->btime = btimeMatrix;
-    thePlanet->dtime = dtimeMatrix;
-    return thePlanet;
+int copy_planet_rows(planet_t *dst, planet_t *src, int fromRow, int toRow)
+{
+    if (dst == NULL || src == NULL || dst->nrow != src->nrow || dst->ncol != src->ncol
+        || dst->halo != src->halo || fromRow < 0 || toRow > (int) src->nrow || fromRow > toRow) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Le righe sono contigue: si copiano per intero, bordo fantasma compreso
+    const int border = src->halo ? 1 : 0;
+    if (fromRow == 0)
+        fromRow = -border;
+    if (toRow == (int) src->nrow)
+        toRow += border;
+    const long from = CELL_INDEX(src, fromRow, -border);
+    const size_t cells = (size_t) (toRow - fromRow) * src->stride;
+    memcpy(&dst->wcells[from], &src->wcells[from], cells * sizeof(cell_t));
+    memcpy(&dst->bcells[from], &src->bcells[from], cells * sizeof(int));
+    memcpy(&dst->dcells[from], &src->dcells[from], cells * sizeof(int));
+    memcpy(&dst->ucells[from], &src->ucells[from], cells * sizeof(unsigned int));
+    return 0;
+}
+
+void replace_planet(planet_t *p, planet_t *src)
+{
+    // Il pianeta mantiene lo stesso indirizzo, cambiano solo i blocchi a cui punta
+    void *oldSlab = p->slab;
+    *p = *src;
+    free(src);
+    free(oldSlab);
+}
+
+int set_planet_halo(planet_t *p, bool halo)
+{
+    if (p == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (p->halo == halo)
+        return 0;
+
+    planet_t *newLayout = alloc_planet(p->nrow, p->ncol, halo, true);
+    if (newLayout == NULL)
+        return -1;
+    for (unsigned int row = 0; row < p->nrow; row++) {
+        memcpy(newLayout->w[row], p->w[row], p->ncol * sizeof(cell_t));
+        memcpy(newLayout->btime[row], p->btime[row], p->ncol * sizeof(int));
+        memcpy(newLayout->dtime[row], p->dtime[row], p->ncol * sizeof(int));
+        memcpy(&newLayout->ucells[CELL_INDEX(newLayout, row, 0)], &p->ucells[CELL_INDEX(p, row, 0)], p->ncol * sizeof(unsigned int));
+    }
+
+    replace_planet(p, newLayout);
+    sync_planet_halo(p);
+    return 0;
+}
+
+void sync_planet_halo(planet_t *p)
+{
+    if (p == NULL || !p->halo)
+        return;
+
+    const int nrow = p->nrow;
+    const int ncol = p->ncol;
+    memcpy(&p->wcells[CELL_INDEX(p, -1, 0)], &p->wcells[CELL_INDEX(p, nrow - 1, 0)], ncol * sizeof(cell_t));
+    memcpy(&p->wcells[CELL_INDEX(p, nrow, 0)], &p->wcells[CELL_INDEX(p, 0, 0)], ncol * sizeof(cell_t));
+    for (int row = 0; row < nrow; row++) {
+        p->wcells[CELL_INDEX(p, row, -1)]   = p->wcells[CELL_INDEX(p, row, ncol - 1)];
+        p->wcells[CELL_INDEX(p, row, ncol)] = p->wcells[CELL_INDEX(p, row, 0)];
+    }
 }
 
 void free_planet(planet_t *p)
 {
     if (p != NULL) {
-        for (unsigned int row = 0; row < p->nrow; row++) {
-            free(p->w[row]);
-            free(p->btime[row]);
-            free(p->dtime[row]);
-        }
-        free(p->w);
-        free(p->btime);
-        free(p->dtime);
+        free(p->slab);
         free(p);
     }
 }
@@ -117,8 +214,9 @@ int print_planet(FILE *f, planet_t *p)
     if (fprintf(f, "%u\n%u\n", p->nrow, p->ncol) == -1)
         return -1;
     for (unsigned int row = 0; row < p->nrow; row++) {
+        const cell_t *rowCells = &p->wcells[CELL_INDEX(p, row, 0)];
         for (unsigned int col = 0; col < p->ncol; col++)
-            if (fprintf(f, "%c ", cell_to_char(p->w[row][col])) == -1)
+            if (fprintf(f, "%c ", cell_to_char(rowCells[col])) == -1)
                 return -1;
 
         // Sostituisce l'ultimo spazio con \n. Come mostrato nella specifica
@@ -135,8 +233,9 @@ int print_planet_colored(planet_t *p)
         return -1;
 
     for (unsigned int row = 0; row < p->nrow; row++) {
+        const cell_t *rowCells = &p->wcells[CELL_INDEX(p, row, 0)];
         for (unsigned int col = 0; col < p->ncol; col++) {
-            char cell = cell_to_char(p->w[row][col]);
+            char cell = cell_to_char(rowCells[col]);
             switch (cell) {
                 case 'W': printf("\x1b[36m%c\x1b[0m ", cell); break; // ciano
                 case 'S': printf("\x1b[31m%c\x1b[0m ", cell); break; // rosso
@@ -167,80 +266,53 @@ planet_t *load_planet(FILE *f)
     if (ncols < 1 || nrows < 1)
         return NULL;
 
-    // Nessun errore, prova ad allocare il pianeta e la matrice
-    planet_t *thePlanet = (planet_t *) malloc(sizeof(planet_t));
-    cell_t **planetMatrix = (cell_t **) malloc(nrows * sizeof(cell_t *));
-    if (thePlanet == NULL || planetMatrix == NULL) {
-        free(thePlanet);
-        free(planetMatrix);
+    // Nessun errore, prova ad allocare il pianeta
+    planet_t *thePlanet = new_planet(nrows, ncols);
+    if (thePlanet == NULL) {
+        errno = ENOMEM;
         return NULL;
     }
 
     // Lettura della matrice
-    planetMatrix[0] = (cell_t *) malloc(ncols * sizeof(cell_t));
-    bool merror = false; // Serve per la pulizia quando fallisce una malloc
+    bool cerror = false; // true se nel file c'è un carattere non valido
     int row = 0, col = 0, cell = 0, c;
+    cell_t *rowCells = &thePlanet->wcells[CELL_INDEX(thePlanet, 0, 0)];
     while ((c = fgetc(f)) != EOF) {
         if (c == ' ' || c == '\n')
             continue; // skip degli spazi vuoti
         if ((cell = char_to_cell((char)c)) == -1) {
-            merror = true;
+            cerror = true;
             DEBUG_PRINTF("Il carattere %c non è valido.\n", c);
             break;
         }
-        planetMatrix[row][col] = cell;
+        rowCells[col] = cell;
 
         if (col < ncols - 1)
             col++;
         else if (row < nrows -1) {
             row++;
             col = 0;
-            planetMatrix[row] = (cell_t *) malloc(ncols * sizeof(cell_t));
-            if (planetMatrix[row] == NULL) {
-                merror = true;
-                DEBUG_PRINTF("Non è stato possibile allocare la riga %d.\n", row);
-                break;
-            }
+            rowCells = &thePlanet->wcells[CELL_INDEX(thePlanet, row, 0)];
         }
         else // La matrice è piena
             break;
     }
 
-    // Alloca le matrici ausiliarie del pianeta
-    int **btimeMatrix = NULL;
-    int **dtimeMatrix = NULL;
-    bool merror2 = 0 != alloc_counters_matrices(nrows, ncols, &btimeMatrix, &dtimeMatrix);
-
-    // Una malloc è fallita oppure il file è terminato prima che la matrice fosse piena
-    if (merror || merror2 || row != nrows - 1 || col != ncols - 1) {
-        errno = merror ? ENOMEM : ERANGE;
-        free(thePlanet);
-        for (int i = 0; i < row; i++)
-            free(planetMatrix[i]);
-        free(planetMatrix);
-        if (!merror2) {
-            for (int i = 0; i < row; i++) {
-                free(btimeMatrix[i]);
-                free(dtimeMatrix[i]);
-            }
-            free(btimeMatrix);
-            free(dtimeMatrix);
-        }
+    // Il file contiene un carattere non valido oppure è terminato prima che la matrice fosse piena
+    if (cerror || row != nrows - 1 || col != ncols - 1) {
+        errno = ERANGE;
+        free_planet(thePlanet);
         return NULL;
     }
 
     errno = 0;
-    thePlanet->w     = planetMatrix;
-    thePlanet->nrow  = nrows;
-    thePlanet->ncol  = ncols;
-    thePlanet->btime = btimeMatrix;
-    thePlanet->dtime = dtimeMatrix;
     return thePlanet;
 }
 
 wator_t *new_wator(char *fileplan)
 {
     int sd, sb, fb;
+    unsigned long seed;
 
     // Caricamento file configurazione
     FILE *file = fopen(CONFIGURATION_FILE, "r");
@@ -250,6 +322,8 @@ wator_t *new_wator(char *fileplan)
     }
 
     int argsAssigned = fscanf(file, "sd %d\nsb %d\nfb %d", &sd, &sb, &fb);
+    if (argsAssigned != 3 || fscanf(file, "\nrs %lu", &seed) != 1)
+        seed = DEFAULT_SEED; // Il seme è opzionale
     fclose(file);
     if (argsAssigned != 3) {
         DEBUG_PRINTF("Formato del file di configurazione %s non riconosciuto.\n", fileplan);
@@ -278,6 +352,7 @@ wator_t *new_wator(char *fileplan)
     aWator->fb      = fb;
     aWator->nwork   = 0;
     aWator->chronon = 0;
+    aWator->seed    = seed;
     aWator->nf      = fish_count(thePlanet);
     aWator->ns      = shark_count(thePlanet);
     aWator->plan    = thePlanet;
@@ -292,13 +367,121 @@ void free_wator(wator_t *pw)
     }
 }
 
-inline int shark_rule1(wator_t *pw, int x, int y, int *k, int *l)
+/*  INFO SUI NUMERI CASUALI
+    Le regole non usano rand(), che ha uno stato globale protetto da una lock
+    e renderebbe il risultato dipendente dall'ordine in cui i worker lo
+    chiamano. Il numero casuale è invece una funzione hash (il finalizzatore
+    di splitmix64) della tupla (seme, chronon, cella): non c'è uno stato da
+    condividere o proteggere, e a parità di seme e di ordine di
+    aggiornamento delle celle la simulazione è riproducibile.
+ */
+static inline unsigned long long mix64(unsigned long long z)
 {
-    if (pw == NULL || pw->plan == NULL) {
-        errno = EINVAL;
-        return -1;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+inline unsigned int cell_random(wator_t *pw, int x, int y, unsigned int n)
+{
+    DEBUG_ASSERT(n > 0);
+    unsigned long long key = mix64(pw->seed + 0x9e3779b97f4a7c15ULL * (unsigned long long) pw->chronon);
+    key = mix64(key ^ ((unsigned long long) x * pw->plan->ncol + y));
+    return (unsigned int) ((key >> 32) * n >> 32);
+}
+
+/* Scrive value nella cella (x,y). Se il pianeta ha il bordo fantasma e la
+   cella è su un lato della matrice, aggiorna anche la sua copia sul lato
+   opposto, cosicché le celle vicine possano leggerla senza riavvolgere le
+   coordinate. */
+static inline void write_cell(planet_t *p, int x, int y, cell_t value)
+{
+    p->wcells[CELL_INDEX(p, x, y)] = value;
+    if (!p->halo)
+        return;
+    if (x == 0)
+        p->wcells[CELL_INDEX(p, p->nrow, y)] = value;
+    if (x == (int) p->nrow - 1)
+        p->wcells[CELL_INDEX(p, -1, y)] = value;
+    if (y == 0)
+        p->wcells[CELL_INDEX(p, x, p->ncol)] = value;
+    if (y == (int) p->ncol - 1)
+        p->wcells[CELL_INDEX(p, x, -1)] = value;
+}
+
+/* Implementazione di neighbor_cell senza controlli sugli argomenti. Con il
+   bordo fantasma il contenuto della cella vicina si legge spostandosi
+   nell'indice di una riga o di una colonna, e le coordinate di arrivo vengono
+   riavvolte con un confronto (senza divisioni) solo se si è su un lato. */
+static inline int probe_neighbor(planet_t *p, int x, int y, motion_t m, int *destX, int *destY)
+{
+    if (p->halo) {
+        const long here = CELL_INDEX(p, x, y);
+        const int lastRow = p->nrow - 1;
+        const int lastCol = p->ncol - 1;
+        long there;
+        switch (m) {
+            case UP:
+                *destX = x == 0 ? lastRow : x - 1;
+                *destY = y;
+                there = here - p->stride;
+                break;
+            case DOWN:
+                *destX = x == lastRow ? 0 : x + 1;
+                *destY = y;
+                there = here + p->stride;
+                break;
+            case LEFT:
+                *destX = x;
+                *destY = y == 0 ? lastCol : y - 1;
+                there = here - 1;
+                break;
+            case RIGHT:
+                *destX = x;
+                *destY = y == lastCol ? 0 : y + 1;
+                there = here + 1;
+                break;
+            default:
+                return -1;
+        }
+        return *(volatile cell_t*)&p->wcells[there];
+    }
+
+    switch (m) {
+        // Il cast evita che (x-1) venga trasformato in unsigned, con conseguente underflow quando x è 0
+        case UP:
+            *destX = (x - 1) % (int) p->nrow;
+            *destY = y;
+            break;
+        case DOWN:
+            *destX = (x + 1) % (int) p->nrow;
+            *destY = y;
+            break;
+        case LEFT:
+            *destX = x;
+            *destY = (y - 1) % (int) p->ncol;
+            break;
+        case RIGHT:
+            *destX = x;
+            *destY = (y + 1) % (int) p->ncol;
+            break;
+        default:
+            return -1;
     }
-    DEBUG_ASSERT(x >= 0 && y >= 0 && pw->plan->w[x][y] == SHARK);
+
+    // Trasforma l'operazione resto del C in operazione modulo
+    if (*destX < 0)
+        *destX += (int) p->nrow;
+    if (*destY < 0)
+        *destY += (int) p->ncol;
+
+    // Il cast suggerisce al compilatore di non usare una versione della cella salvata nella cache
+    return *(volatile cell_t*)&p->wcells[CELL_INDEX(p, *destX, *destY)];
+}
+
+static inline int shark_rule1_delta(wator_t *pw, int x, int y, int *k, int *l, wator_delta_t *delta)
+{
+    DEBUG_ASSERT(x >= 0 && y >= 0 && pw->plan->wcells[CELL_INDEX(pw->plan, x, y)] == SHARK);
 
     planet_t *p = pw->plan;
     motion_t motions[4] = {UP, RIGHT, DOWN, LEFT};
@@ -309,13 +492,13 @@ inline int shark_rule1(wator_t *pw, int x, int y, int *k, int *l)
     int destX, destY;
 
     for (int i = 0; i < 4; i++) { // Gli squali mangiano...
-        cell = neighbor_cell(p, x, y, motions[i], &destX, &destY);
+        cell = probe_neighbor(p, x, y, motions[i], &destX, &destY);
         if (cell == FISH) {
-            p->w[destX][destY] = WATER;
-            p->dtime[x][y] = 0;
+            write_cell(p, destX, destY, WATER);
+            p->dcells[CELL_INDEX(p, x, y)] = 0;
             *k = destX;
             *l = destY;
-            pw->nf--;
+            delta->fishEaten++;
             move_cell(p, x, y, *k, *l);
             return EAT;
         }
@@ -328,7 +511,7 @@ inline int shark_rule1(wator_t *pw, int x, int y, int *k, int *l)
     }
 
     if (waterCellsCount > 0) { // ... si spostano ...
-        int randomIndex = rand() % waterCellsCount;
+        int randomIndex = cell_random(pw, x, y, waterCellsCount);
         *k = waterCellsX[randomIndex];
         *l = waterCellsY[randomIndex];
         move_cell(p, x, y, *k, *l);
@@ -340,57 +523,51 @@ inline int shark_rule1(wator_t *pw, int x, int y, int *k, int *l)
     return STOP; // ... o rimangono fermi!
 }
 
-inline int shark_rule2(wator_t *pw, int x, int y, int *k, int *l)
+static inline int shark_rule2_delta(wator_t *pw, int x, int y, int *k, int *l, wator_delta_t *delta)
 {
-    if (pw == NULL || pw->plan == NULL) {
-        errno = EINVAL;
-        return -1;
-    }
-    DEBUG_ASSERT(x >= 0 && y >= 0 && pw->plan->w[x][y] == SHARK);
+    DEBUG_ASSERT(x >= 0 && y >= 0 && pw->plan->wcells[CELL_INDEX(pw->plan, x, y)] == SHARK);
 
     *k = -1; // nessun figlio... per adesso
     *l = -1;
 
     planet_t *p = pw->plan;
-    if (p->btime[x][y] < pw->sb)
-        p->btime[x][y] += 1;
+    const long here = CELL_INDEX(p, x, y);
+    if (p->bcells[here] < pw->sb)
+        p->bcells[here] += 1;
     else { // prova a partorire
-        p->btime[x][y] = 0;
+        p->bcells[here] = 0;
         int cell;
         int destX, destY;
         motion_t motions[4] = {UP, RIGHT, DOWN, LEFT}; // le celle da ispezionare
         for (int i = 0; i < 4; i++) {
-            cell = neighbor_cell(p, x, y, motions[i], &destX, &destY);
+            cell = probe_neighbor(p, x, y, motions[i], &destX, &destY);
             if (cell == WATER) { // c'è spazio per il figlio
                 *k = destX;
                 *l = destY;
-                pw->ns++;
-                p->w[destX][destY] = SHARK;
+                delta->sharkBorn++;
+                write_cell(p, destX, destY, SHARK);
                 break;
             }
         }
     }
 
-    if (p->dtime[x][y] < pw->sd) {
-        p->dtime[x][y] += 1;
+    if (p->dcells[here] < pw->sd) {
+        p->dcells[here] += 1;
         return ALIVE;
     }
     else {
-        p->w[x][y] = WATER;
-        p->btime[x][y] = 0;
-        p->dtime[x][y] = 0;
-        pw->ns--;
+        write_cell(p, x, y, WATER);
+        p->bcells[here] = 0;
+        p->dcells[here] = 0;
+        delta->sharkDead++;
         return DEAD;
     }
 }
 
-inline int fish_rule3(wator_t *pw, int x, int y, int *k, int *l)
+static inline int fish_rule3_delta(wator_t *pw, int x, int y, int *k, int *l, wator_delta_t *delta)
 {
-    if (pw == NULL || pw->plan == NULL) {
-        errno = EINVAL;
-        return -1;
-    }
-    DEBUG_ASSERT(x >= 0 && y >= 0 && pw->plan->w[x][y] == FISH);
+    (void) delta; // Spostandosi i pesci non nascono e non muoiono
+    DEBUG_ASSERT(x >= 0 && y >= 0 && pw->plan->wcells[CELL_INDEX(pw->plan, x, y)] == FISH);
 
     planet_t *p = pw->plan;
     motion_t motions[4] = {UP, RIGHT, DOWN, LEFT};
@@ -401,7 +578,7 @@ inline int fish_rule3(wator_t *pw, int x, int y, int *k, int *l)
     int destX, destY;
 
     for (int i = 0; i < 4; i++) {
-        cell = neighbor_cell(p, x, y, motions[i], &destX, &destY);
+        cell = probe_neighbor(p, x, y, motions[i], &destX, &destY);
         if (cell == WATER) {
             waterCellsX[waterCellsCount] = destX;
             waterCellsY[waterCellsCount] = destY;
@@ -410,7 +587,7 @@ inline int fish_rule3(wator_t *pw, int x, int y, int *k, int *l)
     }
 
     if (waterCellsCount > 0) { // sceglie una cella
-        int randomIndex = rand() % waterCellsCount;
+        int randomIndex = cell_random(pw, x, y, waterCellsCount);
         *k = waterCellsX[randomIndex];
         *l = waterCellsY[randomIndex];
         move_cell(p, x, y, *k, *l);
@@ -422,32 +599,29 @@ inline int fish_rule3(wator_t *pw, int x, int y, int *k, int *l)
     return STOP;
 }
 
-inline int fish_rule4(wator_t *pw, int x, int y, int *k, int *l)
+static inline int fish_rule4_delta(wator_t *pw, int x, int y, int *k, int *l, wator_delta_t *delta)
 {
-    if (pw == NULL || pw->plan == NULL) {
-        errno = EINVAL;
-        return -1;
-    }
-    DEBUG_ASSERT(x >= 0 && y >= 0 && pw->plan->w[x][y] == FISH);
+    DEBUG_ASSERT(x >= 0 && y >= 0 && pw->plan->wcells[CELL_INDEX(pw->plan, x, y)] == FISH);
 
     *k = -1; // nessun figlio... per adesso
     *l = -1;
 
     planet_t *p = pw->plan;
-    if (p->btime[x][y] < pw->fb)
-        p->btime[x][y] += 1;
+    const long here = CELL_INDEX(p, x, y);
+    if (p->bcells[here] < pw->fb)
+        p->bcells[here] += 1;
     else { // prova a partorire
-        p->btime[x][y] = 0;
+        p->bcells[here] = 0;
         int cell;
         int destX, destY;
         motion_t motions[4] = {UP, RIGHT, DOWN, LEFT}; // le celle da ispezionare
         for (int i = 0; i < 4; i++) {
-            cell = neighbor_cell(p, x, y, motions[i], &destX, &destY);
+            cell = probe_neighbor(p, x, y, motions[i], &destX, &destY);
             if (cell == WATER) {
                 *k = destX;
                 *l = destY;
-                pw->nf++;
-                p->w[destX][destY] = FISH;
+                delta->fishBorn++;
+                write_cell(p, destX, destY, FISH);
                 break; // è riuscito a partorire
             }
         }
@@ -455,99 +629,62 @@ inline int fish_rule4(wator_t *pw, int x, int y, int *k, int *l)
     return 0;
 }
 
-inline int neighbor_cell(planet_t *p, int x, int y, motion_t m, int *destX, int *destY)
+/* Definisce la versione pubblica di una regola: controlla gli argomenti,
+   applica la regola e aggiorna subito il numero di pesci e squali. */
+#define DEFINE_PUBLIC_RULE(rule) \
+  int rule(wator_t *pw, int x, int y, int *k, int *l) \
+  { \
+      if (pw == NULL || pw->plan == NULL) { \
+          errno = EINVAL; \
+          return -1; \
+      } \
+      wator_delta_t delta = {0}; \
+      int result = rule##_delta(pw, x, y, k, l, &delta); \
+      apply_delta(pw, &delta); \
+      return result; \
+  }
+
+DEFINE_PUBLIC_RULE(shark_rule1)
+DEFINE_PUBLIC_RULE(shark_rule2)
+DEFINE_PUBLIC_RULE(fish_rule3)
+DEFINE_PUBLIC_RULE(fish_rule4)
+
+void apply_delta(wator_t *pw, wator_delta_t *delta)
 {
-    if (p == NULL)
-        return -1;
-
-    switch (m) {
-        // Il cast evita che (x-1) venga trasformato in unsigned, con conseguente underflow quando x è 0
-        case UP:
-            *destX = (x - 1) % (int) p->nrow;
-            *destY = y;
-            break;
-        case DOWN:
-            *destX = (x + 1) % (int) p->nrow;
-            *destY = y;
-            break;
-        case LEFT:
-            *destX = x;
-            *destY = (y - 1) % (int) p->ncol;
-            break;
-        case RIGHT:
-            *destX = x;
-            *destY = (y + 1) % (int) p->ncol;
-            break;
-        default:
-            return -1;
-    }
-
-    // Trasforma l'operazione resto del C in operazione modulo
-    if (*destX < 0)
-        *destX += (int) p->nrow;
-    if (*destY < 0)
-        *destY += (int) p->ncol;
-
-    // Il cast suggerisce al compilatore di non usare una versione della cella salvata nella cache
-    return *(volatile cell_t*)&p->w[*destX][*destY];
+    pw->nf += delta->fishBorn - delta->fishEaten;
+    pw->ns += delta->sharkBorn - delta->sharkDead;
+    memset(delta, 0, sizeof(wator_delta_t));
 }
 
-int alloc_counters_matrices(unsigned int nrows, unsigned int ncols, int ***btime, int ***dtime)
+inline int neighbor_cell(planet_t *p, int x, int y, motion_t m, int *destX, int *destY)
 {
-    int **tempBtime = (int **) malloc(nrows * sizeof(int *));
-    int **tempDtime = (int **) malloc(nrows * sizeof(int *));
-    if (tempBtime == NULL || tempDtime == NULL) {
-        free(tempBtime);
-        free(tempDtime);
-        return -1;
-    }
-
-    bool outOfMemory = false;
-    unsigned int row = 0;     // È qui perché essere visibile al codice di pulizia
-    for (; row < nrows; row++) {
-        tempBtime[row] = (int *) calloc(ncols, sizeof(int));
-        tempDtime[row] = (int *) calloc(ncols, sizeof(int));
-        if (tempBtime[row] == NULL || tempDtime[row] == NULL) {
-            outOfMemory = true;
-            DEBUG_PRINTF("Non è stato possibile allocare la riga %d.\n", row);
-            break;
-        }
-    }
-
-    if (outOfMemory) { // Una malloc ha fallito, fa pulizia
-        for (unsigned int i = 0; i < row; i++) {
-            free(tempBtime[i]);
-            free(tempDtime[i]);
-        }
-        free(tempBtime);
-        free(tempDtime);
+    if (p == NULL)
         return -1;
-    }
 
-    *btime = tempBtime;
-    *dtime = tempDtime;
-    return 0;
+    return probe_neighbor(p, x, y, m, destX, destY);
 }
 
 inline void move_cell(planet_t *p, int fromX, int fromY, int toX, int toY)
 {
-    if (p->w[toX][toY] != WATER)
+    const long from = CELL_INDEX(p, fromX, fromY);
+    const long to   = CELL_INDEX(p, toX, toY);
+    if (p->wcells[to] != WATER)
         return;
 
-    cell_t who = p->w[fromX][fromY];
+    cell_t who = p->wcells[from];
     if (who == FISH) {
-        p->w[toX][toY] = FISH;
-        p->w[fromX][fromY] = WATER;
-        p->btime[toX][toY] = p->btime[fromX][fromY];
-        p->btime[fromX][fromY] = 0;
+        write_cell(p, toX, toY, FISH);
+        write_cell(p, fromX, fromY, WATER);
+        p->bcells[to] = p->bcells[from];
+        p->bcells[from] = 0;
     }
     else if (who == SHARK) {
-        p->w[toX][toY] = SHARK;
-        p->w[fromX][fromY] = WATER;
-        p->dtime[toX][toY] = p->dtime[fromX][fromY];
-        p->dtime[fromX][fromY] = 0;
-        p->btime[toX][toY] = p->btime[fromX][fromY];
-        p->btime[fromX][fromY] = 0;
+        write_cell(p, toX, toY, SHARK);
+        write_cell(p, fromX, fromY, WATER);
+        p->dcells[to] = p->dcells[from];
+        p->dcells[from] = 0;
+        p->bcells[to] = p->bcells[from];
+        p->bcells[from] = 0;
     }
 }
 
@@ -559,10 +696,12 @@ int fish_count(planet_t *p)
     }
 
     int result = 0;
-    for (unsigned int row = 0; row < p->nrow; row++)
+    for (unsigned int row = 0; row < p->nrow; row++) {
+        const cell_t *rowCells = &p->wcells[CELL_INDEX(p, row, 0)];
         for (unsigned int col = 0; col < p->ncol; col++)
-            if (p->w[row][col] == FISH)
+            if (rowCells[col] == FISH)
                 result++;
+    }
     return result;
 }
 
@@ -574,25 +713,28 @@ int shark_count(planet_t *p)
     }
 
     int result = 0;
-    for (unsigned int row = 0; row < p->nrow; row++)
+    for (unsigned int row = 0; row < p->nrow; row++) {
+        const cell_t *rowCells = &p->wcells[CELL_INDEX(p, row, 0)];
         for (unsigned int col = 0; col < p->ncol; col++)
-            if (p->w[row][col] == SHARK)
+            if (rowCells[col] == SHARK)
                 result++;
+    }
     return result;
 }
 
 /*  INFO PER LA COMPRENSIONE DELL'ALGORITMO
     Per garantire che uno squalo o un pesce venga aggiornato esattamente una
-    volta per ogni chronon, si fa uso di due array di bool, grandi ncol e
-    chiamati cellsToSkipCurrRow, cellsToSkipNextRow. Ad ogni iterazione, se
-    cellsToSkipCurrRow[c]=1 allora all'elemento in quella posizione non vanno
-    applicate regole. Altrimenti le regole vanno applicate e, se lo squalo, il
-    pesce, o un loro figlio:
-    - si è spostato nella riga in basso (destR > r) allora imposta
-      cellsToSkipNextRow[destC]=1 per ignorarlo in una delle prossime iterazioni
-    - si è spostato nella riga a destra, allora imposta
-      cellsToSkipCurrRow[destC]=1 per ignorarlo alla prossima iterazione.
-
+    volta per ogni chronon, ogni cella del pianeta ha un contatore (la matrice
+    ucells) che contiene il "timbro" dell'ultimo chronon in cui le sono state
+    applicate le regole: CHRONON_STAMP(pw), ossia il numero del chronon
+    corrente più uno. Se il timbro di una cella è quello del chronon corrente
+    allora all'elemento in quella posizione non vanno applicate regole.
+    Altrimenti le regole vanno applicate e la cella in cui si trova lo squalo
+    o il pesce al termine della regola 1 (e quella dell'eventuale figlio)
+    vengono timbrate.
+    Poiché il timbro cambia a ogni chronon, la matrice non va mai azzerata:
+    le celle timbrate nel chronon precedente hanno già un timbro "scaduto".
+    La stessa matrice è usata da update_wator e da update_wator_rect.
 
     NOTA:
     - Non vengono controllati i valori restituiti dalle 4 regole perché
@@ -602,15 +744,17 @@ int shark_count(planet_t *p)
       macro che applica la giusta regola in base al tipo di animale.
  */
 
+#define CHRONON_STAMP(pw) ((unsigned int) (pw)->chronon + 1)
+
 #define APPLY_PROPER_RULE_NO(ruleNumber, toWho, x, y, k, l) { \
     switch (ruleNumber) { \
         case 1: \
-            if (toWho == SHARK) shark_rule1(pw, x, y, k, l); \
-            else                 fish_rule3(pw, x, y, k, l); \
+            if (toWho == SHARK) shark_rule1_delta(pw, x, y, k, l, delta); \
+            else                 fish_rule3_delta(pw, x, y, k, l, delta); \
             break; \
         case 2: \
-            if (toWho == SHARK) shark_rule2(pw, x, y, k, l); \
-            else                 fish_rule4(pw, x, y, k, l); \
+            if (toWho == SHARK) shark_rule2_delta(pw, x, y, k, l, delta); \
+            else                 fish_rule4_delta(pw, x, y, k, l, delta); \
             break; \
     } }
 
@@ -624,56 +768,49 @@ int update_wator(wator_t *pw)
     planet_t *p = pw->plan;
     const int rows = p->nrow;
     const int cols = p->ncol;
-    bool *cellsToSkipCurrRow = (bool *) calloc(cols, sizeof(bool));
-    bool *cellsToSkipNextRow = (bool *) malloc(cols * sizeof(bool));
+    const unsigned int stamp = CHRONON_STAMP(pw);
+    wator_delta_t chrononDelta = {0};
+    wator_delta_t *delta = &chrononDelta;
 
     for (int r = 0; r < rows; r++) {
+        const cell_t *rowCells = &p->wcells[CELL_INDEX(p, r, 0)];
+        const unsigned int *rowStamps = &p->ucells[CELL_INDEX(p, r, 0)];
         for (int c = 0; c < cols; c++) {
-            cellsToSkipNextRow[c] = false;
-            if (cellsToSkipCurrRow[c])
+            if (rowStamps[c] == stamp)
                 continue;
 
-            cell_t radar = p->w[r][c];
+            cell_t radar = rowCells[c];
             if (radar != WATER) {
                 int destR = -1, destC = -1;
                 APPLY_PROPER_RULE_NO(1, radar, r, c, &destR, &destC);
-                if (destC == 0 || destC > c) // Spostato a destra
-                    cellsToSkipCurrRow[destC] = true;
-                else if (destR == 0 || destR > r) // Spostato in basso
-                    cellsToSkipNextRow[destC] = true;
+                p->ucells[CELL_INDEX(p, destR, destC)] = stamp;
                 APPLY_PROPER_RULE_NO(2, radar, destR, destC, &destR, &destC);
-                if (destC == 0 || destC > c) // C'è stato un parto nella cella a destra
-                    cellsToSkipCurrRow[destC] = true;
-                else if (destR == 0 || destR > r) // C'è stato un parto nella cella in basso
-                    cellsToSkipNextRow[destC] = true;
+                if (destR != -1) // => destC != -1 => c'è stato un parto
+                    p->ucells[CELL_INDEX(p, destR, destC)] = stamp;
             }
         }
-
-        bool *tmp = cellsToSkipCurrRow;
-        cellsToSkipCurrRow = cellsToSkipNextRow;
-        cellsToSkipNextRow = tmp;
     }
 
-    free(cellsToSkipCurrRow);
-    free(cellsToSkipNextRow);
+    apply_delta(pw, delta);
     pw->chronon++;
 
     return 0;
 }
 
 /*  INFO PER LA COMPRENSIONE DELL'ALGORITMO
-    Similmente al metodo update_wator, dobbiamo tener traccia delle celle già
-    aggiornate. Nella seguente funzione però non è possibile ottimizzare
-    lo spazio usando solo un array di bool per la riga corrente e uno per la
-    successiva.
-    È necessario passare come argomento una matrice di bool, cosicché le future
-    chiamate a update_wator_rect possano conoscere quali celle sono state già
-    aggiornate
-
+    Come in update_wator, le celle già aggiornate nel chronon corrente sono
+    quelle con il timbro CHRONON_STAMP(pw): le future chiamate a
+    update_wator_rect sullo stesso chronon (anche di altri thread) sanno quali
+    celle saltare senza che nessuno debba azzerare una matrice tra un chronon
+    e l'altro.
+    Le variazioni della popolazione non vengono scritte in pw->nf e pw->ns, che
+    sarebbero condivise tra tutti i thread che aggiornano il pianeta, ma
+    accumulate in delta: chi chiama la funzione le applica con apply_delta
+    quando nessun altro thread sta aggiornando il pianeta.
  */
-inline int update_wator_rect(wator_t *pw, rect_t *rect, bool **cellsToSkipMatrix)
+inline int update_wator_rect(wator_t *pw, rect_t *rect, wator_delta_t *delta)
 {
-    if (pw == NULL || pw->plan == NULL || cellsToSkipMatrix == NULL
+    if (pw == NULL || pw->plan == NULL || delta == NULL
         || rect->fromRow < 0
         || rect->fromCol < 0
         || (unsigned int) rect->fromRow + rect->rows > pw->plan->nrow
@@ -684,6 +821,7 @@ inline int update_wator_rect(wator_t *pw, rect_t *rect, bool **cellsToSkipMatrix
     }
 
     planet_t *p = pw->plan;
+    const unsigned int stamp = CHRONON_STAMP(pw);
 
     const int fromRow = rect->fromRow;
     const int fromCol = rect->fromCol;
@@ -691,18 +829,20 @@ inline int update_wator_rect(wator_t *pw, rect_t *rect, bool **cellsToSkipMatrix
     const int toCol   = rect->fromCol + rect->cols - 1;
 
     for (int r = fromRow; r <= toRow; r++) {
+        volatile cell_t *rowCells = &p->wcells[CELL_INDEX(p, r, 0)];
+        volatile unsigned int *rowStamps = &p->ucells[CELL_INDEX(p, r, 0)];
         for (int c = fromCol; c <= toCol; c++) {
-            if (*(volatile bool*)&cellsToSkipMatrix[r][c])
+            if (rowStamps[c] == stamp)
                 continue;
 
-            cell_t radar = *(volatile cell_t*)&p->w[r][c];
+            cell_t radar = rowCells[c];
             if (radar != WATER) {
                 int destR = -1, destC = -1;
                 APPLY_PROPER_RULE_NO(1, radar, r, c, &destR, &destC);
-                cellsToSkipMatrix[destR][destC] = true;
+                p->ucells[CELL_INDEX(p, destR, destC)] = stamp;
                 APPLY_PROPER_RULE_NO(2, radar, destR, destC, &destR, &destC);
                 if (destR != -1) // => destC != -1 => c'è stato un parto
-                    cellsToSkipMatrix[destR][destC] = true;
+                    p->ucells[CELL_INDEX(p, destR, destC)] = stamp;
             }
         }
     }
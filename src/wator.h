@@ -12,6 +12,10 @@
 /** file di configurazione */
 static const char CONFIGURATION_FILE[] = "wator.conf";
 
+/** seme dei numeri casuali usato se il file di configurazione non contiene
+    la riga opzionale "rs seme" dopo sd, sb e fb */
+#define DEFAULT_SEED 1UL
+
 /** tipo delle celle del pianeta:
    SHARK squalo
    FISH pesce
@@ -20,21 +24,46 @@ static const char CONFIGURATION_FILE[] = "wator.conf";
 */
 typedef enum cell { SHARK, FISH, WATER } cell_t;
 
+/** allineamento, in byte, dei blocchi contigui che contengono le matrici del
+    pianeta (la dimensione tipica di una linea di cache) */
+#define PLANET_ALIGNMENT 64
+
 /** tipo matrice acquatica che rappreseneta il pianeta */
 typedef struct planet {
   /** righe */
   unsigned int nrow;
   /** colonne */
   unsigned int ncol;
-  /** matrice pianeta */
+  /** matrice pianeta (puntatori alle righe di wcells) */
   cell_t ** w;
-  /** matrice contatori nascita (pesci e squali)*/
+  /** matrice contatori nascita (pesci e squali) (puntatori alle righe di bcells) */
   int ** btime;
-  /** matrice contatori morte (squali )*/
+  /** matrice contatori morte (squali) (puntatori alle righe di dcells) */
   int ** dtime;
+  /** distanza, in celle, tra l'inizio di una riga e l'inizio della successiva
+      nei blocchi wcells, bcells, dcells e ucells */
+  unsigned int stride;
+  /** true se le matrici hanno un bordo fantasma di una cella per lato: le
+      celle di riga -1 e nrow, e di colonna -1 e ncol, sono copie delle celle
+      sul lato opposto del pianeta (vedi set_planet_halo) */
+  bool halo;
+  /** celle del pianeta memorizzate per righe in un unico blocco contiguo */
+  cell_t * wcells;
+  /** contatori nascita memorizzati per righe in un unico blocco contiguo */
+  int * bcells;
+  /** contatori morte memorizzati per righe in un unico blocco contiguo */
+  int * dcells;
+  /** per ogni cella, il timbro (chronon + 1) dell'ultimo chronon in cui le
+      sono state applicate le regole; memorizzati come wcells */
+  unsigned int * ucells;
+  /** l'unica allocazione (allineata) che contiene tutti i blocchi precedenti */
+  void * slab;
 
 } planet_t;
 
+/** indice della cella (r,c) all'interno dei blocchi contigui del pianeta p */
+#define CELL_INDEX(p, r, c) ((long) (r) * (long) (p)->stride + (long) (c))
+
 /** struttura che raccoglie le informazioni di simulazione */
 typedef struct wator {
   /** sd numero chronon morte squali per digiuno */
@@ -51,10 +80,31 @@ typedef struct wator {
   int nwork;
   /** durata simulazione */
   int chronon;
+  /** seme dei numeri casuali usati dalle regole (vedi cell_random) */
+  unsigned long seed;
   /** pianeta acquatico */
   planet_t* plan;
 } wator_t;
 
+/** variazioni della popolazione accumulate durante l'aggiornamento di una
+    porzione del pianeta (vedi update_wator_rect) */
+typedef struct wator_delta {
+  /** pesci nati */
+  int fishBorn;
+  /** pesci mangiati dagli squali */
+  int fishEaten;
+  /** squali nati */
+  int sharkBorn;
+  /** squali morti per digiuno */
+  int sharkDead;
+} wator_delta_t;
+
+/** somma le variazioni di popolazione delta a pw->nf e pw->ns, poi azzera delta
+    \param pw puntatore alla struttura di simulazione
+    \param delta le variazioni da applicare
+ */
+void apply_delta(wator_t *pw, wator_delta_t *delta);
+
 /** struttura che rappresenta una porzione della matrice di un pianeta */
 typedef struct prectangle {
     /** riga di partenza */
@@ -90,8 +140,10 @@ char cell_to_char(cell_t a) ;
   */
 int char_to_cell(char c) ;
 
-/** crea un nuovo pianeta vuoto (tutte le celle contengono WATER) utilizzando
-    la rappresentazione con un vettore di puntatori a righe
+/** crea un nuovo pianeta vuoto (tutte le celle contengono WATER). Le matrici
+    del pianeta sono memorizzate per righe in un'unica allocazione contigua e
+    allineata, alla quale si accede con CELL_INDEX; i vettori di puntatori a
+    righe w, btime e dtime puntano all'interno della stessa allocazione
     \param nrow numero righe
     \param numero colonne
 
@@ -100,6 +152,61 @@ int char_to_cell(char c) ;
  */
 planet_t *new_planet(unsigned int nrow, unsigned int ncol);
 
+/** alloca un pianeta con le stesse dimensioni e la stessa disposizione in
+    memoria di p, senza scriverne le matrici: il loro contenuto è indefinito
+    finché non viene copiato con copy_planet_rows. Le pagine di memoria
+    vengono così assegnate al nodo NUMA del primo thread che le scrive.
+    \param p puntatore al pianeta da imitare
+
+    \return NULL se si sono verificati problemi nell'allocazione (setta errno)
+    \return il nuovo pianeta altrimenti
+ */
+planet_t *new_planet_like(planet_t *p);
+
+/** copia le righe [fromRow, toRow) di tutte le matrici di src in dst,
+    compreso il bordo fantasma adiacente. Più thread possono copiare
+    contemporaneamente righe diverse.
+
+    \param dst il pianeta di destinazione (allocato con new_planet_like(src))
+    \param src il pianeta da copiare
+    \param fromRow la prima riga da copiare
+    \param toRow la riga successiva all'ultima da copiare
+
+    \return 0 se tutto e' andato bene
+    \return -1 se i pianeti hanno dimensioni o disposizioni diverse o le
+            righe non sono valide (setta errno)
+ */
+int copy_planet_rows(planet_t *dst, planet_t *src, int fromRow, int toRow);
+
+/** sostituisce le matrici di p con quelle di src e dealloca src e le vecchie
+    matrici di p. L'indirizzo di p non cambia.
+    \param p puntatore al pianeta da modificare
+    \param src puntatore al pianeta da cui prendere le matrici
+ */
+void replace_planet(planet_t *p, planet_t *src);
+
+/** cambia la disposizione in memoria delle matrici del pianeta, aggiungendo o
+    togliendo il bordo fantasma. Con il bordo fantasma le celle vicine a
+    quelle interne si leggono con un semplice spostamento nell'indice e il
+    riavvolgimento delle coordinate avviene solo sui lati; le regole
+    mantengono il bordo allineato con il lato opposto. Chi modifica
+    direttamente le celle di un pianeta con bordo fantasma deve chiamare
+    sync_planet_halo.
+
+    \param p puntatore al pianeta
+    \param halo true per aggiungere il bordo, false per toglierlo
+
+    \return 0 se tutto e' andato bene (il contenuto del pianeta non cambia)
+    \return -1 se si e' verificato un errore (setta errno)
+ */
+int set_planet_halo(planet_t *p, bool halo);
+
+/** copia le celle dei lati del pianeta nel bordo fantasma sul lato opposto.
+    Non fa nulla se il pianeta non ha il bordo fantasma.
+    \param p puntatore al pianeta
+ */
+void sync_planet_halo(planet_t *p);
+
 /** dealloca un pianeta (e tutta la matrice ...)
     \param p pianeta da deallocare
 
@@ -162,6 +269,20 @@ void free_wator(wator_t *pw);
 #define MOVE 2
 #define ALIVE 3
 #define DEAD 4
+/** restituisce un numero pseudocasuale per la cella (x,y) nel chronon
+    corrente. Il numero dipende solo da pw->seed, pw->chronon e (x,y): la
+    funzione non ha stato, può essere chiamata da più thread
+    contemporaneamente e, a parità di seme, restituisce sempre gli stessi
+    valori.
+
+    \param pw puntatore alla struttura di simulazione
+    \param (x,y) le coordinate della cella
+    \param n il numero di valori possibili (> 0)
+
+    \return un numero in [0, n)
+ */
+unsigned int cell_random(wator_t *pw, int x, int y, unsigned int n);
+
 /** Regola 1: gli squali mangiano e si spostano
   \param pw puntatore alla struttura di simulazione
   \param (x,y) coordinate iniziali dello squalo
@@ -325,17 +446,6 @@ typedef enum motion { UP, DOWN, LEFT, RIGHT } motion_t;
  */
 int neighbor_cell(planet_t *p, int x, int y, motion_t m, int *destX, int *destY);
 
-/** crea e azzera le due matrici btime e dtime di un pianeta.
-
-    \param (nrows, cols) le dimensioni del pianeta
-    \param (***btime) il puntatore alla matrice btime (modificate in uscita)
-    \param (***dtime) il puntatore alla matrice dtime (modificate in uscita)
-    \return 0 se le matrici sono state allocate (nel chiamante, *btime *dtime
-            conterranno i puntatori a tali matrici)
-    \return -1 se si e' verificato un errore
- */
-int alloc_counters_matrices(unsigned int nrows, unsigned int ncols, int ***btime, int ***dtime);
-
 /** sposta un pesce o uno squalo dalle coordinate (fromX,fromY) a (toX, toY).
     Muove anche i contatori btime (e dtime nel caso di uno squalo) dalla vecchia
     alla nuova posizione. La cella abbandonata diventa WATER con i contatori
@@ -353,15 +463,19 @@ void move_cell(planet_t *p, int fromX, int fromY, int toX, int toY);
  */
 int print_planet_colored(planet_t *p);
 
-/** aggiorna una porzione del pianeta. Salta le celle x,y per le quali
-    cellsToSkipMatrix[x,y]=true.
+/** aggiorna una porzione del pianeta. Salta le celle x,y già aggiornate nel
+    chronon corrente (quelle il cui timbro in pw->plan->ucells è pw->chronon+1),
+    anche se da un'altra chiamata a update_wator_rect. A differenza delle
+    regole, non modifica pw->nf e pw->ns ma accumula nascite e morti in delta,
+    cosicché più thread possano aggiornare porzioni diverse del pianeta
+    contemporaneamente.
 
     \param pw puntatore al pianeta
     \param rect il rettangolo da aggiornare. Deve essere all'interno del pianeta
-    \param cellsToSkipMatrix una matrice di bool di dimensioni pari a pw->plan
+    \param delta le variazioni della popolazione (modificate in uscita)
     \return 0 se tutto e' andato bene
     \return -1 se si e' verificato un errore (setta errno)
  */
-int update_wator_rect(wator_t *pw, rect_t *rect, bool **cellsToSkipMatrix);
+int update_wator_rect(wator_t *pw, rect_t *rect, wator_delta_t *delta);
 
 #endif
@@ -0,0 +1,212 @@
+/** \file wave.c
+    \author Giorgio Vinciguerra
+    \date Giugno 2015
+    \copyright Copyright (c) 2015 Giorgio Vinciguerra. All rights reserved.
+    \note  Si dichiara che il contenuto di questo file è in ogni sua parte opera
+           originale dell' autore.
+    \brief File contenente l'implementazione del motore di esecuzione a
+           fronte d'onda.
+*/
+/*
+ INFO PER LA COMPRENSIONE DELL'ALGORITMO
+ Aggiornando un riquadro si leggono e scrivono celle fino a due posizioni
+ fuori dai suoi bordi, quindi un riquadro interferisce solo con gli otto
+ riquadri che lo circondano (gli altri sono lontani almeno un riquadro, cioè
+ almeno PARTITION_GAP celle). I motori a farm e a pool eseguono i riquadri
+ nell'ordine (chronon, batch): se due riquadri vicini vengono aggiornati
+ nello stesso ordine relativo, il risultato non cambia, qualunque sia
+ l'ordine degli altri.
+
+ Ogni riquadro ha un livello: il n° di chronon della passata per cui è già
+ stato aggiornato. Il riquadro X può essere aggiornato per il chronon c
+ (cioè quando il suo livello è c) se ogni vicino Y di un batch precedente
+ ha livello almeno c+1 (è già stato aggiornato per il chronon c) e ogni
+ vicino di un batch successivo ha livello almeno c (è già stato aggiornato
+ per il chronon c-1). Due vicini non sono mai pronti insieme, quindi non
+ serve altra mutua esclusione, e non c'è attesa circolare: il riquadro più
+ indietro nell'ordine (chronon, batch) è sempre pronto.
+ Il numero del chronon, usato dalle regole per i timbri e per i numeri
+ casuali, è diverso da riquadro a riquadro: ogni worker usa una propria
+ copia della struttura wator, di cui cambia solo il campo chronon.
+ */
+
+#include "wave.h"
+#include "barrier.h"
+#include "phases.h"
+#include "trace.h"
+#include "control.h"
+#include "utils.h"
+#include <sched.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/** Numero massimo di vicini di un riquadro */
+#define WAVE_NEIGHBORS 8
+
+/** Numero di scansioni dei propri riquadri senza trovarne uno pronto prima
+    che un worker ceda il processore */
+#define WAVE_SPIN 64
+
+/* Un riquadro della griglia, con i vicini con cui interferisce */
+typedef struct wave_tile {
+    rect_t *rect;
+    int batch;
+    int neighbors;                   // n° di vicini (distinti dal riquadro)
+    int neighbor[WAVE_NEIGHBORS];    // indici dei vicini in waveTiles
+    int neighborBefore[WAVE_NEIGHBORS]; // 1 se il vicino è di un batch precedente
+} wave_tile_t;
+
+/* La barriera su cui si sincronizzano i worker alla fine di ogni passata */
+static barrier_t waveBarrier;
+
+static wave_tile_t *waveTiles; // i riquadri, per righe
+static int *tileLevel;         // tileLevel[t] è il livello del riquadro t
+static int totalTiles;
+static int passChronons;       // n° di chronon della passata corrente
+static int spin;               // n° di scansioni a vuoto prima di cedere il processore
+
+/* Diventa true alla fine dell'ultima passata della simulazione */
+static volatile bool waveTerminating = false;
+
+/* Calcola il n° di chronon della prossima passata */
+static int next_pass_length()
+{
+    long length = waveChronons;
+    long chronon = wator->chronon;
+    if (visualizerSocket != -1 && chrInterval - chronon % chrInterval < length)
+        length = chrInterval - chronon % chrInterval;
+    if (rebalanceInterval > 0 && rebalanceInterval - chronon % rebalanceInterval < length)
+        length = rebalanceInterval - chronon % rebalanceInterval;
+    if (maxChronons > 0 && maxChronons - chronon < length)
+        length = maxChronons - chronon > 0 ? maxChronons - chronon : 1;
+    if (control_pause_requested()) // In pausa o in esecuzione passo passo si avanza di un chronon alla volta
+        length = 1;
+    if (chronDelay > 0) // Ogni chronon ha la sua scadenza (vedi complete_chronon)
+        length = 1;
+    return length;
+}
+
+/* Eseguita dall'ultimo worker arrivato sulla barriera di fine passata. Le
+   variazioni della popolazione di tutta la passata vengono sommate dal primo
+   complete_chronon, quando il pianeta è già all'ultimo chronon. La pausa
+   viene attesa solo dopo l'ultimo, quando wator->chronon è quello del
+   pianeta */
+static void end_of_pass(void *arg)
+{
+    for (int c = 0; c < passChronons; c++)
+        complete_chronon();
+    control_chronon_done();
+    if (mustTerminateFlag || mustStopEngine)
+        waveTerminating = true;
+    for (int t = 0; t < totalTiles; t++)
+        tileLevel[t] = 0;
+    passChronons = next_pass_length();
+}
+
+void setup_wave()
+{
+    partition_t *part = planetPartition;
+    totalTiles = part->totalRects;
+    waveTiles = malloc(totalTiles * sizeof(wave_tile_t));
+    tileLevel = calloc(totalTiles, sizeof(int));
+    if (waveTiles == NULL || tileLevel == NULL)
+        print_fatal_error("Errore nel setup del motore a fronte d'onda");
+
+    for (int i = 0; i < part->tilesY; i++)
+        for (int j = 0; j < part->tilesX; j++) {
+            wave_tile_t *tile = &waveTiles[i * part->tilesX + j];
+            tile->rect = part->tiles[i * part->tilesX + j];
+            tile->batch = tile_batch(part, i, j);
+            tile->neighbors = 0;
+            for (int di = -1; di <= 1; di++)
+                for (int dj = -1; dj <= 1; dj++) {
+                    int ni = (i + di + part->tilesY) % part->tilesY;
+                    int nj = (j + dj + part->tilesX) % part->tilesX;
+                    if (ni == i && nj == j) // Con un solo riquadro su una dimensione, il vicino è sé stesso
+                        continue;
+                    tile->neighbor[tile->neighbors] = ni * part->tilesX + nj;
+                    tile->neighborBefore[tile->neighbors] = tile_batch(part, ni, nj) < tile->batch;
+                    tile->neighbors++;
+                }
+        }
+
+    waveTerminating = false;
+    barrier_init(&waveBarrier, totalWorkers);
+    spin = totalWorkers <= sysconf(_SC_NPROCESSORS_ONLN) ? WAVE_SPIN : 1;
+    passChronons = next_pass_length();
+}
+
+void teardown_wave()
+{
+    free(waveTiles);
+    free(tileLevel);
+}
+
+/* true se il riquadro t può essere aggiornato per il chronon del suo livello */
+static inline bool is_ready(int t)
+{
+    const wave_tile_t *tile = &waveTiles[t];
+    int level = tileLevel[t]; // Scritto solo dal worker che possiede il riquadro
+    if (level == passChronons)
+        return false;
+    for (int n = 0; n < tile->neighbors; n++)
+        if (__atomic_load_n(&tileLevel[tile->neighbor[n]], __ATOMIC_ACQUIRE) < level + tile->neighborBefore[n])
+            return false;
+    return true;
+}
+
+void *wave_worker_loop(void *arg)
+{
+    int workerNumber = *(int *)arg;
+    create_worker_file(workerNumber);
+    free(arg);
+    phase_thread(workerNumber);
+    trace_thread(workerNumber);
+
+    wator_delta_t *delta = &workerDeltas[workerNumber].delta;
+    int firstTile = (long) workerNumber * totalTiles / totalWorkers;
+    int lastTile  = (long) (workerNumber + 1) * totalTiles / totalWorkers;
+
+    while (!waveTerminating) {
+        // Copia della simulazione in cui cambia solo il chronon (vedi sopra)
+        wator_t local = *(wator_t *) wator;
+        int baseChronon = local.chronon;
+        int pending = (lastTile - firstTile) * passChronons; // aggiornamenti che mancano al blocco
+        int idleScans = 0;
+        unsigned long long passStart = phase_now(), updating = 0;
+
+        while (pending > 0) {
+            bool progress = false;
+            for (int t = firstTile; t < lastTile; t++)
+                while (is_ready(t)) { // Un riquadro avanza finché i vicini lo permettono
+                    unsigned long long start = phase_now();
+                    local.chronon = baseChronon + tileLevel[t];
+                    update_wator_rect(&local, waveTiles[t].rect, delta);
+                    unsigned long long end = phase_now();
+                    updating += end - start;
+                    trace_event(TRACE_TASK, start, end, waveTiles[t].rect, waveTiles[t].batch, local.chronon);
+                    __atomic_store_n(&tileLevel[t], tileLevel[t] + 1, __ATOMIC_RELEASE);
+                    pending--;
+                    progress = true;
+                }
+
+            if (progress)
+                idleScans = 0;
+            else if (++idleScans < spin)
+                CPU_RELAX();
+            else {
+                sched_yield(); // I vicini sono di altri worker, che devono ancora avanzare
+                idleScans = 0;
+            }
+        }
+
+        // Il tempo della passata non speso ad aggiornare riquadri è attesa dei vicini
+        threadPhases->ns[PHASE_UPDATE] += updating;
+        unsigned long long start = phase_now();
+        threadPhases->ns[PHASE_WAIT] += start - passStart - updating;
+        if (!barrier_wait(&waveBarrier, end_of_pass, NULL))
+            phase_add(PHASE_WAIT, start);
+    }
+
+    return NULL;
+}
@@ -0,0 +1,44 @@
+/** \file wave.h
+    \author Giorgio Vinciguerra
+    \date Giugno 2015
+    \copyright Copyright (c) 2015 Giorgio Vinciguerra. All rights reserved.
+    \note  Si dichiara che il contenuto di questo file è in ogni sua parte opera
+           originale dell' autore.
+    \brief File contenente i prototipi delle funzioni del motore di esecuzione
+           a fronte d'onda, che fa avanzare i riquadri di più chronon senza
+           barriere tra un batch e l'altro.
+
+    Nel motore a fronte d'onda ogni worker possiede un blocco contiguo di
+    riquadri e li fa avanzare di chronon in chronon appena i riquadri vicini
+    lo permettono, senza aspettare il resto del pianeta. I worker si
+    sincronizzano con una barriera solo alla fine di una passata di al più
+    waveChronons chronon, quando l'ultimo arrivato esegue complete_chronon
+    per ognuno dei chronon della passata. Il pianeta risultante è identico a
+    quello dei motori a farm e a pool con la stessa suddivisione.
+*/
+
+#ifndef __WAVE__H
+#define __WAVE__H
+
+#include "farm.h"
+
+/** Numero massimo di chronon di una passata del motore a fronte d'onda. Una
+    passata termina comunque al primo chronon multiplo di chrInterval (se c'è
+    un visualizer) o di rebalanceInterval, e al chronon maxChronons: in quei
+    chronon il pianeta deve essere tutto allo stesso chronon. Mentre la
+    simulazione è in pausa (vedi control.h) o la sua velocità è limitata da
+    chronDelay le passate durano un chronon */
+extern long waveChronons;
+
+/** Prepara i riquadri, i loro vicini e la barriera del motore. Va chiamata
+    dopo setup_farm e prima di creare i thread worker, anche quando il motore
+    viene riavviato. */
+void setup_wave();
+
+/** Libera la memoria allocata da setup_wave. */
+void teardown_wave();
+
+/** Il ciclo eseguito da uno dei thread worker del motore a fronte d'onda. */
+void *wave_worker_loop(void *arg);
+
+#endif